@@ -0,0 +1,111 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "models.h"
+
+/**
+ * Bump allocator for everything that lives as long as a scan: group entries, keys and labels.
+ * Nothing is freed individually, the chunks are released in bulk by sf_arena_free.
+ */
+
+#define SF_ARENA_ALIGN(n) (((n) + 15) & ~((size_t)15))
+
+/**********************************************************************************************
+ * sf_arena_alloc: Carve size bytes out of the current chunk. A new chunk, twice the size of
+ *   the previous one, is started when the current one is full so the number of chunks stays
+ *   logarithmic in the bytes allocated.
+ **********************************************************************************************/
+
+void *sf_arena_alloc(sf_arena_t *arena, size_t size)
+{
+    struct sf_arena_chunk *chunk = arena->head;
+
+    size = SF_ARENA_ALIGN(size);
+    if (chunk == NULL || chunk->used + size > chunk->size)
+        {
+            size_t csize = SF_ARENA_CHUNK;
+            if (chunk != NULL && chunk->size * 2 <= SF_ARENA_MAXCHUNK)
+                {
+                    csize = chunk->size * 2;
+                }
+            if (csize < size)
+                {
+                    csize = size;
+                }
+
+            chunk = malloc(sizeof(struct sf_arena_chunk) + csize); // freed by sf_arena_free
+            if (chunk == NULL)
+                {
+                    return NULL;
+                }
+            chunk->size = csize;
+            chunk->used = 0;
+            chunk->next = arena->head;
+            arena->head = chunk;
+        }
+
+    void *p = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return p;
+}
+
+char *sf_arena_strdup(sf_arena_t *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = sf_arena_alloc(arena, len);
+    if (copy != NULL)
+        {
+            memcpy(copy, str, len);
+        }
+    return copy;
+}
+
+/**********************************************************************************************
+ * sf_arena_reset: Forget everything allocated so far but keep the newest (largest) chunk
+ *   around so a table rebuilt on every refresh stops touching malloc once it is warm.
+ **********************************************************************************************/
+
+void sf_arena_reset(sf_arena_t *arena)
+{
+    struct sf_arena_chunk *chunk = arena->head;
+    if (chunk == NULL)
+        {
+            return;
+        }
+
+    struct sf_arena_chunk *older = chunk->next;
+    while (older != NULL)
+        {
+            struct sf_arena_chunk *next = older->next;
+            free(older);
+            older = next;
+        }
+    chunk->next = NULL;
+    chunk->used = 0;
+    arena->allocated = 0;
+}
+
+void sf_arena_free(sf_arena_t *arena)
+{
+    struct sf_arena_chunk *chunk = arena->head;
+    while (chunk != NULL)
+        {
+            struct sf_arena_chunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+    arena->head = NULL;
+    arena->allocated = 0;
+}
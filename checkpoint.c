@@ -0,0 +1,259 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "summarizefiles.h"
+
+/**
+ * --checkpoint / --resume: with checkpointing on, directories are visited in name order, so
+ * the traversal frontier is fully described by the last directory that was finished. The
+ * checkpoint holds that directory, the index of the root being scanned, the merged group
+ * totals and the files the content workers had not counted yet, written to a temporary file
+ * and renamed over the previous checkpoint. The workers are not waited for, the traversal
+ * only holds them off the queue while the totals are merged. Every checkpoint still writes
+ * all the groups, not what changed since the last one. Grouped by extension that is a few
+ * kilobytes, but the rows of --by-owner=ext, --by-mime and --cube and the paths of --top N
+ * grow with the tree, and so does every checkpoint.
+ *
+ * On resume every directory is placed relative to that cursor: ancestors are entered without
+ * counting their files again, directories sorting before it are skipped whole, and everything
+ * after it is scanned as usual. The files that were with the workers are counted first.
+ */
+
+#define SF_CHECKPOINT_MAGIC "SFCK"
+#define SF_CHECKPOINT_VERSION 3
+
+
+/**********************************************************************************************
+ * sf_checkpoint_write: Save the totals so far. rootidx and cursor say where to pick up: the
+ *   root being scanned and the last directory finished in it, "" when the root is untouched.
+ **********************************************************************************************/
+
+int sf_checkpoint_write(sumfiles_t *self, int rootidx, const char *cursor)
+{
+    char tmppath[strlen(self->checkpoint) + 5];
+    sf_groups_t merged;
+    char *inflight = NULL;   // the paths the totals do not hold yet
+    size_t inflightlen = 0;
+    int ret = -1;
+
+    if (sf_groups_init(&merged) != 0)
+        {
+            return -1;
+        }
+    merged.flags = self->snapshot.flags;
+    merged.topn = self->snapshot.topn;
+    FILE *list = open_memstream(&inflight, &inflightlen);
+    if (list != NULL)
+        {
+            ret = self->pool != NULL ? sf_pool_collect(self->pool, self, &merged, list)
+                  : sf_groups_collect(self, &merged, list);
+            if (fclose(list) != 0)
+                {
+                    ret = -1;
+                }
+        }
+
+    sprintf(tmppath, "%s.tmp", self->checkpoint);
+    FILE *out = fopen(tmppath, "wb");
+    if (out == NULL || ret != 0)
+        {
+            perror(tmppath);
+            if (out != NULL)
+                {
+                    fclose(out);
+                }
+            sf_groups_destroy(&merged);
+            free(inflight);
+            return -1;
+        }
+
+    if (fwrite(SF_CHECKPOINT_MAGIC, 1, 4, out) != 4
+            || sf_putvarint(out, SF_CHECKPOINT_VERSION) != 0
+            || sf_putvarint(out, sf_dump_modes(self->popts)) != 0
+            || sf_putvarint(out, rootidx) != 0
+            || sf_putstring(out, cursor) != 0
+            || sf_putvarint(out, SF_ZIGZAG(self->min_mod_time)) != 0
+            || sf_putvarint(out, SF_ZIGZAG(self->max_mod_time)) != 0
+            || sf_putvarint(out, self->exceptions) != 0
+            || fwrite(inflight, 1, inflightlen, out) != inflightlen
+            || sf_putstring(out, "") != 0
+            || sf_dump_groups(out, &merged) != 0
+            || fflush(out) != 0
+            || fsync(fileno(out)) != 0)
+        {
+            ret = -1;
+        }
+    if (fclose(out) != 0)
+        {
+            ret = -1;
+        }
+    sf_groups_destroy(&merged);
+    free(inflight);
+
+    if (ret != 0 || rename(tmppath, self->checkpoint) != 0)
+        {
+            perror(self->checkpoint);
+            unlink(tmppath);
+            return -1;
+        }
+    self->last_checkpoint = time(NULL);
+    return 0;
+}
+
+/* The files that were with the content workers, up to the empty path that ends them */
+static int sf_checkpoint_loadfiles(sumfiles_t *self, FILE *in)
+{
+    char path[PATH_MAX];
+    size_t size = 0;
+
+    while (sf_getstring(in, path, sizeof(path)) == 0)
+        {
+            if (path[0] == 0)
+                {
+                    return 0;
+                }
+            if (self->nresume == size)
+                {
+                    size = size ? size * 2 : 64;
+                    char **files = realloc(self->resume_files, size * sizeof(char *));
+                    if (files == NULL)
+                        {
+                            return -1;
+                        }
+                    self->resume_files = files;
+                }
+            self->resume_files[self->nresume] = strdup(path); // freed once counted, see sf_summarize
+            if (self->resume_files[self->nresume] == NULL)
+                {
+                    return -1;
+                }
+            self->nresume++;
+        }
+    return -1;
+}
+
+/**********************************************************************************************
+ * sf_checkpoint_load: Restore the totals and the position of a previous run into self. The
+ *   totals go into the calling thread's group table.
+ **********************************************************************************************/
+
+int sf_checkpoint_load(sumfiles_t *self)
+{
+    FILE *in = fopen(self->checkpoint, "rb");
+    if (in == NULL)
+        {
+            perror(self->checkpoint);
+            return -1;
+        }
+
+    char magic[4];
+    uint64_t version, modes, rootidx, min_mtime, max_mtime, exceptions;
+    int ret = -1;
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, SF_CHECKPOINT_MAGIC, 4) != 0
+            || sf_getvarint(in, &version) != 0 || version != SF_CHECKPOINT_VERSION)
+        {
+            fprintf(stderr, "%s: not a checkpoint written by this version\n", self->checkpoint);
+        }
+    else if (sf_getvarint(in, &modes) != 0 || modes != (uint64_t)sf_dump_modes(self->popts))
+        {
+            fprintf(stderr, "%s: the checkpoint was written with different options\n", self->checkpoint);
+        }
+    else if (sf_getvarint(in, &rootidx) == 0
+             && sf_getstring(in, self->resume_cursor, sizeof(self->resume_cursor)) == 0
+             && sf_getvarint(in, &min_mtime) == 0
+             && sf_getvarint(in, &max_mtime) == 0
+             && sf_getvarint(in, &exceptions) == 0
+             && sf_checkpoint_loadfiles(self, in) == 0)
+        {
+            sf_groups_t *groups = sf_localgroups(self);
+            if (groups != NULL)
+                {
+                    pthread_mutex_lock(&groups->lock);
+                    ret = sf_load_groups(in, groups);
+                    pthread_mutex_unlock(&groups->lock);
+                }
+            self->resume_root = rootidx;
+            self->min_mod_time = SF_UNZIGZAG(min_mtime);
+            self->max_mod_time = SF_UNZIGZAG(max_mtime);
+            self->exceptions = exceptions;
+            if (ret != 0)
+                {
+                    fprintf(stderr, "%s: checkpoint is truncated\n", self->checkpoint);
+                }
+        }
+    fclose(in);
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_checkpoint_position: Where dir falls relative to the resume cursor in the name ordered
+ *   traversal. Paths are compared one component at a time, the way fts sorts siblings.
+ **********************************************************************************************/
+
+int sf_checkpoint_position(const char *dir, const char *cursor)
+{
+    size_t dlen = strlen(dir);
+    size_t idx = 0;
+
+    while (dlen > 1 && dir[dlen - 1] == '/')
+        {
+            dlen--;
+        }
+    while (idx < dlen && dir[idx] == cursor[idx])
+        {
+            idx++;
+        }
+
+    if (idx == dlen)
+        {
+            if (cursor[idx] == 0)
+                {
+                    return SF_RESUME_DONE;
+                }
+            if (cursor[idx] == '/' || dir[dlen - 1] == '/')
+                {
+                    return SF_RESUME_ANCESTOR;
+                }
+        }
+    else if (cursor[idx] == 0 && dir[idx] == '/')
+        {
+            // below the cursor, finished before it was
+            return SF_RESUME_DONE;
+        }
+
+    // the paths part inside a component, order by that component
+    size_t start = idx;
+    while (start > 0 && dir[start - 1] != '/')
+        {
+            start--;
+        }
+    size_t dend = start, cend = start;
+    while (dend < dlen && dir[dend] != '/')
+        {
+            dend++;
+        }
+    while (cursor[cend] != 0 && cursor[cend] != '/')
+        {
+            cend++;
+        }
+    size_t dcomp = dend - start, ccomp = cend - start;
+    int cmp = memcmp(dir + start, cursor + start, dcomp < ccomp ? dcomp : ccomp);
+    if (cmp == 0)
+        {
+            cmp = dcomp < ccomp ? -1 : 1;
+        }
+    return cmp < 0 ? SF_RESUME_DONE : SF_RESUME_AFTER;
+}
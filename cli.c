@@ -0,0 +1,425 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include "libsummarizefiles.h"
+
+/**
+ * sf.exe: the command line over libsummarizefiles. Options are parsed into a struct sf_config
+ * and everything, merge, replay, history and dumps too, runs through the library's public
+ * entry points like any other caller's.
+ */
+
+/* long options without a short form */
+#define SF_OPT_CHECKPOINT_INTERVAL 1000
+#define SF_OPT_WHERE 1001
+#define SF_OPT_STATS 1002
+#define SF_OPT_WORKERS 1003
+#define SF_OPT_TOP 1004
+#define SF_OPT_SHARD 1005
+#define SF_OPT_DUMP 1006
+#define SF_OPT_HISTORY 1007
+#define SF_OPT_DIFF 1008
+#define SF_OPT_TREND 1009
+#define SF_OPT_RECORD 1010
+#define SF_OPT_REPLAY 1011
+#define SF_OPT_MAX_IOPS 1012
+#define SF_OPT_MAX_BANDWIDTH 1013
+#define SF_OPT_MAX_LATENCY 1014
+#define SF_OPT_IDLE 1015
+#define SF_OPT_BY_OWNER 1016
+#define SF_OPT_BY_MIME 1017
+#define SF_OPT_DUPES 1018
+
+void help()
+{
+    printf( "usage: summarizefiles.py [merge | history] [-h] [--time] [--debug] [--lines] [--watch] [--estimate] [--hist] [--json]\n"
+            "                         [--cube [--where VALUE]] [--decompress] [--workers N] [--stats]\n"
+            "                         [--top N] [--shard I/N] [--dump FILE] [--history FILE] [--diff A:B] [--trend N]\n"
+            "                         [--record FILE | --replay FILE]\n"
+            "                         [--max-iops N] [--max-bandwidth SIZE] [--max-latency MS] [--idle]\n"
+            "                         [--by-owner[=ext] | --by-mime] [--dupes]\n"
+            "                         [--checkpoint FILE [--checkpoint-interval SECS] [--resume]] N [N ...]\n"
+            "\n"
+            "positional arguments:\n"
+            "  N            Directories to summarize, with merge the --dump files to combine,\n"
+            "               with history the --history FILE to show\n"
+            "\n"
+            "options:\n"
+            "  -h, --help   show this help message and exit\n"
+            "  --time, -t   Summarize files by date modified. Most sophiscated time summary. Try it!\n"
+            "  --debug, -v  Something don't work, time to debug!\n"
+            "  --lines, -L  Summarize text files by their line count\n"
+            "  --watch, -w  After the scan keep the summary current from filesystem events, until Ctrl-C\n"
+            "  --estimate, -E  Show sampled estimates with confidence intervals until the full scan is done\n"
+            "  --hist, -H   Show the distribution of file sizes in each group\n"
+            "  --json, -j   Write the summary to stdout as JSON when the scan is done\n"
+            "  --cube, -C   Count by extension and time together, shown by extension or with --time by time\n"
+            "  --where VALUE  With --cube, only files with this time bucket, or with --time this extension\n"
+            "  --decompress, -z  With --lines, count the lines inside gzip, xz and zstd compressed files\n"
+            "  --workers N  Threads reading file content for --lines, --by-mime and --dupes, by default\n"
+            "               tuned while the scan runs from the throughput and latency they get\n"
+            "  --stats      Report how fast file content was read, per compression format, and the\n"
+            "               concurrency the stats and reads settled on, on stderr\n"
+            "  --top N      List the N largest and the N newest files of each group when the scan is done\n"
+            "  --shard I/N  Scan only the I-th of N shards, split by the names of the top level entries\n"
+            "  --dump FILE  Save the totals to FILE, to be combined with: summarizefiles merge [options] FILE...\n"
+            "  --history FILE  Append the totals to FILE, shown with: summarizefiles history [options] FILE\n"
+            "  --diff A:B   With history, the groups that grew and shrank most from run A to run B,\n"
+            "               negative runs count from the last one, -2:-1 by default\n"
+            "  --trend N    With history, follow the largest groups over the last N runs\n"
+            "  --record FILE  Save every file counted to FILE, to be fed back with --replay\n"
+            "  --replay FILE  Summarize the files saved with --record instead of scanning, e.g. to time the summary\n"
+            "  --max-iops N  At most N stats and reads per second, over all threads\n"
+            "  --max-bandwidth SIZE  Read file content at most SIZE bytes per second, e.g. 20M\n"
+            "  --max-latency MS  Slow down while stats and reads take longer than MS milliseconds\n"
+            "  --idle       Use the idle I/O scheduling class, only use the disks when nothing else does\n"
+            "  --by-owner[=ext]  Summarize files by the user and group owning them, with =ext by extension too\n"
+            "  --by-mime    Summarize files by the MIME type and encoding of their content\n"
+            "  --dupes      When the scan is done, find files with the same content and show the bytes\n"
+            "               their extra copies take in each group, i.e. what could be reclaimed\n"
+            "  --checkpoint FILE, -c FILE  Save the progress of the scan to FILE every few seconds\n"
+            "  --checkpoint-interval SECS  Seconds between checkpoints, 5 by default\n"
+            "  --resume, -r Continue the scan saved in the --checkpoint FILE\n\n");
+}
+
+/* Parse a byte count with an optional K, M or G suffix (powers of 1024), -1 when malformed */
+static long long parse_size(const char *str)
+{
+    char *end;
+    double value = strtod(str, &end);
+    const char *units = "KMG";
+    const char *unit = *end ? strchr(units, toupper((unsigned char)*end)) : NULL;
+    if (end == str || value < 0 || (*end && (unit == NULL || end[1] != 0)))
+        {
+            return -1;
+        }
+    if (unit != NULL)
+        {
+            value *= 1LL << (10 * (unit - units + 1));
+        }
+    return value;
+}
+
+/* the watch Ctrl-C and SIGTERM end, so the final view and stats are still shown */
+static sumfiles_t *watching = NULL;
+
+static void onsignal(int sig)
+{
+    (void)sig;
+    sf_interrupt(watching);
+}
+
+/* ################################################################################################
+ *  Main method for parsing args and initiating a file summary scan.
+ * ################################################################################################ */
+
+
+int main(int argc, char *argv[])
+{
+    int arg;
+
+    const struct option long_options[] =
+    {
+        { "help", no_argument, NULL, 'h' },
+        { "debug", no_argument, NULL, 'd' },
+        { "lines", no_argument, NULL, 'L' },
+        { "time", no_argument, NULL, 't' },
+        { "watch", no_argument, NULL, 'w' },
+        { "estimate", no_argument, NULL, 'E' },
+        { "hist", no_argument, NULL, 'H' },
+        { "json", no_argument, NULL, 'j' },
+        { "cube", no_argument, NULL, 'C' },
+        { "where", required_argument, NULL, SF_OPT_WHERE },
+        { "decompress", no_argument, NULL, 'z' },
+        { "workers", required_argument, NULL, SF_OPT_WORKERS },
+        { "stats", no_argument, NULL, SF_OPT_STATS },
+        { "top", required_argument, NULL, SF_OPT_TOP },
+        { "shard", required_argument, NULL, SF_OPT_SHARD },
+        { "dump", required_argument, NULL, SF_OPT_DUMP },
+        { "history", required_argument, NULL, SF_OPT_HISTORY },
+        { "diff", required_argument, NULL, SF_OPT_DIFF },
+        { "trend", required_argument, NULL, SF_OPT_TREND },
+        { "record", required_argument, NULL, SF_OPT_RECORD },
+        { "replay", required_argument, NULL, SF_OPT_REPLAY },
+        { "max-iops", required_argument, NULL, SF_OPT_MAX_IOPS },
+        { "max-bandwidth", required_argument, NULL, SF_OPT_MAX_BANDWIDTH },
+        { "max-latency", required_argument, NULL, SF_OPT_MAX_LATENCY },
+        { "idle", no_argument, NULL, SF_OPT_IDLE },
+        { "by-owner", optional_argument, NULL, SF_OPT_BY_OWNER },
+        { "by-mime", no_argument, NULL, SF_OPT_BY_MIME },
+        { "dupes", no_argument, NULL, SF_OPT_DUPES },
+        { "checkpoint", required_argument, NULL, 'c' },
+        { "checkpoint-interval", required_argument, NULL, SF_OPT_CHECKPOINT_INTERVAL },
+        { "resume", no_argument, NULL, 'r' },
+        {0, 0, 0, 0}
+    };
+
+    static const char *short_options = "hdLtwEHjCzc:r";
+
+    int popts = 0;
+    int option;
+    int c;
+    int merge = 0, history = 0;
+    struct sf_config config;
+    sumfiles_t *self;
+    const char *dump = NULL;
+    const char *histfile = NULL;
+    const char *diff = NULL;
+    int trend = 0;
+    const char *replay = NULL;
+    long long max_bandwidth = 0;
+
+    sf_config_init(&config);
+
+    if (argc > 1 && (strcmp(argv[1], "merge") == 0 || strcmp(argv[1], "history") == 0))
+        {
+            // merge [options] DUMP...: combine the --dump files of a sharded scan
+            // history [options] FILE: compare the runs recorded with --history
+            merge = argv[1][0] == 'm';
+            history = !merge;
+            argv[1] = argv[0];
+            argc--;
+            argv++;
+        }
+    while ((c = getopt_long(argc, argv, short_options, long_options, &option)) != -1)
+        {
+            switch(c)
+                {
+                case 'h':
+                    help();
+                    exit(0);
+                    break;
+                case 'd':
+                    popts = popts + SF_DEBUG;
+                    break;
+                case 'L':
+                    popts = popts + SF_LINES;
+                    break;
+                case 't':
+                    popts = popts + SF_TIME;
+                    break;
+                case 'w':
+                    popts = popts + SF_WATCH;
+                    break;
+                case 'E':
+                    popts = popts + SF_ESTIMATE;
+                    break;
+                case 'H':
+                    popts = popts + SF_HIST;
+                    break;
+                case 'j':
+                    popts = popts + SF_JSON;
+                    break;
+                case 'C':
+                    popts = popts + SF_CUBE;
+                    break;
+                case SF_OPT_WHERE:
+                    config.where = optarg;
+                    break;
+                case 'z':
+                    popts = popts + SF_DECOMPRESS;
+                    break;
+                case SF_OPT_WORKERS:
+                    config.workers = atoi(optarg);
+                    break;
+                case SF_OPT_STATS:
+                    popts = popts + SF_STATS;
+                    break;
+                case SF_OPT_TOP:
+                    config.top = atoi(optarg);
+                    break;
+                case SF_OPT_SHARD:
+                    if (sscanf(optarg, "%d/%d", &config.shard, &config.shards) != 2
+                            || config.shard < 1 || config.shard > config.shards)
+                        {
+                            fprintf(stderr, "--shard expects I/N with 1 <= I <= N, e.g. --shard 2/8\n");
+                            return EXIT_FAILURE;
+                        }
+                    break;
+                case SF_OPT_DUMP:
+                    dump = optarg;
+                    break;
+                case SF_OPT_HISTORY:
+                    histfile = optarg;
+                    break;
+                case SF_OPT_DIFF:
+                    diff = optarg;
+                    break;
+                case SF_OPT_TREND:
+                    trend = atoi(optarg);
+                    break;
+                case SF_OPT_MAX_IOPS:
+                    config.max_iops = atof(optarg);
+                    break;
+                case SF_OPT_MAX_BANDWIDTH:
+                    max_bandwidth = parse_size(optarg);
+                    if (max_bandwidth < 0)
+                        {
+                            fprintf(stderr, "--max-bandwidth expects bytes per second, e.g. 500K or 20M\n");
+                            return EXIT_FAILURE;
+                        }
+                    config.max_bandwidth = max_bandwidth;
+                    break;
+                case SF_OPT_MAX_LATENCY:
+                    config.max_latency = atof(optarg);
+                    break;
+                case SF_OPT_IDLE:
+                    config.idle = 1;
+                    break;
+                case SF_OPT_BY_OWNER:
+                    if (optarg != NULL && strcmp(optarg, "ext") != 0)
+                        {
+                            fprintf(stderr, "--by-owner takes no value or =ext\n");
+                            return EXIT_FAILURE;
+                        }
+                    popts = popts + SF_OWNER + (optarg != NULL ? SF_OWNEREXT : 0);
+                    break;
+                case SF_OPT_BY_MIME:
+                    popts = popts + SF_MIME;
+                    break;
+                case SF_OPT_DUPES:
+                    popts = popts + SF_DUPES;
+                    break;
+                case SF_OPT_RECORD:
+                    config.record = optarg;
+                    break;
+                case SF_OPT_REPLAY:
+                    replay = optarg;
+                    popts = popts + SF_REPLAY;
+                    break;
+                case 'c':
+                    config.checkpoint = optarg;
+                    break;
+                case SF_OPT_CHECKPOINT_INTERVAL:
+                    config.checkpoint_interval = atoi(optarg);
+                    break;
+                case 'r':
+                    config.resume = 1;
+                    break;
+                }
+        }
+
+    if (config.record != NULL && (popts & SF_REPLAY))
+        {
+            // the recording would be truncated before it is read
+            fprintf(stderr, "--record can not be combined with --replay\n");
+            return EXIT_FAILURE;
+        }
+    if ((popts & SF_OWNER) && (popts & (SF_TIME | SF_CUBE)))
+        {
+            fprintf(stderr, "--by-owner can not be combined with --time or --cube\n");
+            return EXIT_FAILURE;
+        }
+    if ((popts & SF_MIME) && (popts & (SF_TIME | SF_CUBE | SF_OWNER | SF_REPLAY)))
+        {
+            // a recording holds no MIME types
+            fprintf(stderr, "--by-mime can not be combined with --time, --cube, --by-owner or --replay\n");
+            return EXIT_FAILURE;
+        }
+    if ((popts & SF_DUPES) && ((popts & (SF_TIME | SF_CUBE | SF_OWNER | SF_MIME | SF_WATCH | SF_REPLAY)) || merge
+                               || dump != NULL || histfile != NULL || config.resume))
+        {
+            // the copies are found by extension, in files that are on disk right now; they are
+            //   resolved after dumps and history are written, and checkpoints keep no candidates
+            fprintf(stderr, "--dupes can not be combined with --time, --cube, --by-owner, --by-mime, --watch,"
+                    " --replay, --dump, --history, --resume or merge\n");
+            return EXIT_FAILURE;
+        }
+    if ( (popts & SF_TIME) == 0 && (popts & SF_LINES) == 0)
+        {
+            // default to a summary by extension
+            popts = popts + SF_EXT;
+        }
+
+    if ((popts & SF_DEBUG))
+        {
+            printf("popts=%d\n", popts);
+        }
+    if (history)
+        {
+            if (optind != argc - 1)
+                {
+                    fprintf(stderr, "history expects the one FILE written with --history\n");
+                    return EXIT_FAILURE;
+                }
+            return sf_history_show(argv[optind], diff, trend, popts, config.top > 0 ? config.top : 10) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    config.popts = popts;
+    self = sf_open(&config);
+    if (self == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+
+    if (merge)
+        {
+            for (arg = optind; arg < argc; arg++)
+                {
+                    if (sf_dump_merge(self, argv[arg]) != 0)
+                        {
+                            return EXIT_FAILURE;
+                        }
+                }
+        }
+    else if (replay != NULL)
+        {
+            if (sf_replay(self, replay) != 0)
+                {
+                    return EXIT_FAILURE;
+                }
+        }
+    else
+        {
+            for (arg = optind; arg < argc; arg++)
+                {
+                    if (sf_scan(self, argv[arg]) != 0)
+                        {
+                            return EXIT_FAILURE;
+                        }
+                }
+        }
+
+    if ((popts & SF_WATCH))
+        {
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = onsignal;
+            watching = self;
+            sigaction(SIGINT, &sa, NULL);
+            sigaction(SIGTERM, &sa, NULL);
+        }
+    if (sf_watch(self) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+    if (dump != NULL && sf_dump_write(self, dump) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    if (histfile != NULL && sf_history_append(self, histfile) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+    sf_finish(self);
+    sf_close(self);
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
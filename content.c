@@ -0,0 +1,355 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <zlib.h>
+#include <lzma.h>
+#ifdef SF_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "summarizefiles.h"
+
+/**
+ * Line counting for --lines. Files are read in fixed size chunks and the newlines of each
+ * chunk counted with memchr. With --decompress, gzip, xz and (built with SF_HAVE_ZSTD) zstd
+ * files are recognised by their magic bytes and streamed through the decompressor into the
+ * same chunk buffer, so a file of any size costs two chunks of memory and no temp files.
+ * A decompressed stream whose first chunk holds a NUL byte is binary and counts 0 lines.
+ * Every chunk read from disk goes through the scan's throttle, see throttle.c.
+ */
+
+
+const char *sf_codec_names[SF_CODECS] = { "plain", "gzip", "xz", "zstd" };
+
+static uint64_t sf_count_newlines(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    uint64_t count = 0;
+    while ((buf = memchr(buf, '\n', end - buf)) != NULL)
+        {
+            count++;
+            buf++;
+        }
+    return count;
+}
+
+struct sf_linecount
+{
+    uint64_t lines;
+    uint64_t inbytes;
+    uint64_t outbytes;
+    int binary;
+    sf_throttle_t *throttle;
+};
+
+static ssize_t sf_content_read(struct sf_linecount *count, int fd, void *buf, size_t size)
+{
+    uint64_t start = sf_throttle_begin(count->throttle, size);
+    ssize_t len = read(fd, buf, size);
+    sf_throttle_end(count->throttle, start, len > 0 ? size - len : size);
+    return len;
+}
+
+/* Count one decompressed chunk, returns -1 once the stream turns out to be binary */
+static int sf_content_chunk(struct sf_linecount *count, const char *buf, size_t len)
+{
+    if (count->outbytes == 0 && memchr(buf, 0, len) != NULL)
+        {
+            count->binary = 1;
+            return -1;
+        }
+    count->outbytes += len;
+    count->lines += sf_count_newlines(buf, len);
+    return 0;
+}
+
+static int sf_lines_plain(int fd, struct sf_linecount *count)
+{
+    char buf[SF_CONTENT_CHUNK];
+    ssize_t len;
+    while ((len = sf_content_read(count, fd, buf, sizeof(buf))) > 0)
+        {
+            count->inbytes += len;
+            count->outbytes += len;
+            count->lines += sf_count_newlines(buf, len);
+        }
+    return len < 0 ? -1 : 0;
+}
+
+static int sf_lines_gzip(int fd, struct sf_linecount *count)
+{
+    unsigned char in[SF_CONTENT_CHUNK];
+    char out[SF_CONTENT_CHUNK];
+    z_stream zs;
+    int ret = Z_OK;
+    int ended = 0;           // a member ended, what follows is another one or the end
+    int done = 0;
+    ssize_t len;
+
+    memset(&zs, 0, sizeof(zs));
+    // 32 + MAX_WBITS: expect a gzip header
+    if (inflateInit2(&zs, 32 + MAX_WBITS) != Z_OK)
+        {
+            return -1;
+        }
+    while (!done && (len = sf_content_read(count, fd, in, sizeof(in))) > 0)
+        {
+            count->inbytes += len;
+            zs.next_in = in;
+            zs.avail_in = len;
+            // a full buffer may leave decoded output pending after the input is used up
+            while (zs.avail_in > 0 || zs.avail_out == 0)
+                {
+                    if (ended && zs.avail_in > 0)
+                        {
+                            // gzip files may hold several members back to back, anything else
+                            // after the last one (zero padding) is not part of the data
+                            if (zs.next_in[0] != 0x1f || (zs.avail_in > 1 && zs.next_in[1] != 0x8b))
+                                {
+                                    done = 1;
+                                    break;
+                                }
+                            ended = 0;
+                        }
+                    zs.next_out = (unsigned char *)out;
+                    zs.avail_out = sizeof(out);
+                    ret = inflate(&zs, Z_NO_FLUSH);
+                    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+                        {
+                            inflateEnd(&zs);
+                            return -1;
+                        }
+                    if (sf_content_chunk(count, out, sizeof(out) - zs.avail_out) != 0)
+                        {
+                            inflateEnd(&zs);
+                            return 0;
+                        }
+                    if (ret == Z_STREAM_END)
+                        {
+                            if (inflateReset(&zs) != Z_OK)
+                                {
+                                    done = 1;
+                                    break;
+                                }
+                            ended = 1;
+                            ret = Z_OK;
+                        }
+                    else if (ret == Z_BUF_ERROR)
+                        {
+                            break;
+                        }
+                }
+        }
+    inflateEnd(&zs);
+    // a read error, or the input ran out in the middle of a member: the file is truncated
+    return len < 0 || (!done && !ended) ? -1 : 0;
+}
+
+static int sf_lines_xz(int fd, struct sf_linecount *count)
+{
+    uint8_t in[SF_CONTENT_CHUNK];
+    char out[SF_CONTENT_CHUNK];
+    lzma_stream xz = LZMA_STREAM_INIT;
+    lzma_ret ret = LZMA_OK;
+    lzma_action action = LZMA_RUN;
+
+    if (lzma_stream_decoder(&xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+        {
+            return -1;
+        }
+    while (ret != LZMA_STREAM_END)
+        {
+            if (xz.avail_in == 0 && action == LZMA_RUN)
+                {
+                    ssize_t len = sf_content_read(count, fd, in, sizeof(in));
+                    if (len < 0)
+                        {
+                            lzma_end(&xz);
+                            return -1;
+                        }
+                    count->inbytes += len;
+                    xz.next_in = in;
+                    xz.avail_in = len;
+                    if (len == 0)
+                        {
+                            action = LZMA_FINISH;
+                        }
+                }
+            xz.next_out = (uint8_t *)out;
+            xz.avail_out = sizeof(out);
+            ret = lzma_code(&xz, action);
+            if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+                {
+                    lzma_end(&xz);
+                    return -1;
+                }
+            if (sf_content_chunk(count, out, sizeof(out) - xz.avail_out) != 0)
+                {
+                    break;
+                }
+        }
+    lzma_end(&xz);
+    return 0;
+}
+
+#ifdef SF_HAVE_ZSTD
+static int sf_lines_zstd(int fd, struct sf_linecount *count)
+{
+    char in[SF_CONTENT_CHUNK];
+    char out[SF_CONTENT_CHUNK];
+    ZSTD_DCtx *zctx = ZSTD_createDCtx();
+    ssize_t len;
+    size_t hint = 1;         // input still expected by the current frame, 0 once it is complete
+    int ret = 0;
+
+    if (zctx == NULL)
+        {
+            return -1;
+        }
+    while (ret == 0 && (len = sf_content_read(count, fd, in, sizeof(in))) > 0)
+        {
+            ZSTD_inBuffer input = { in, len, 0 };
+            int full = 0;
+            count->inbytes += len;
+            // a block decodes to more than a chunk, keep going while the output fills up
+            while (input.pos < input.size || full)
+                {
+                    ZSTD_outBuffer output = { out, sizeof(out), 0 };
+                    hint = ZSTD_decompressStream(zctx, &output, &input);
+                    if (ZSTD_isError(hint))
+                        {
+                            ret = -1;
+                            break;
+                        }
+                    if (sf_content_chunk(count, out, output.pos) != 0)
+                        {
+                            ZSTD_freeDCtx(zctx);
+                            return 0;
+                        }
+                    full = output.pos == output.size;
+                }
+        }
+    ZSTD_freeDCtx(zctx);
+    // a read error, or the input ran out in the middle of a frame: the file is truncated
+    return ret != 0 || len < 0 || hint != 0 ? -1 : 0;
+}
+#endif
+
+/* Which codec a file is compressed with, from its first bytes */
+static int sf_content_codec(const unsigned char *head, size_t len)
+{
+    if (len >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+        {
+            return SF_CODEC_GZIP;
+        }
+    if (len >= 6 && memcmp(head, "\xfd" "7zXZ\0", 6) == 0)
+        {
+            return SF_CODEC_XZ;
+        }
+#ifdef SF_HAVE_ZSTD
+    if (len >= 4 && memcmp(head, "\x28\xb5\x2f\xfd", 4) == 0)
+        {
+            return SF_CODEC_ZSTD;
+        }
+#endif
+    return SF_CODEC_PLAIN;
+}
+
+/**********************************************************************************************
+ * sf_content_lines: Count the lines of a text file into *lines, 0 for anything that is not
+ *   text. magic is the calling thread's libmagic handle, loaded on demand. Returns -1 when the
+ *   file can not be read or classified, or its compressed stream is corrupt.
+ **********************************************************************************************/
+
+int sf_content_lines(sumfiles_t *self, magic_t *magic, const char *fullpath, uint64_t *lines)
+{
+    struct sf_linecount count = { 0, 0, 0, 0, self->throttle };
+    unsigned char head[6];
+    struct timespec start, stop;
+    int codec = SF_CODEC_PLAIN;
+    int ret;
+
+    *lines = 0;
+    int fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        {
+            return -1;
+        }
+    if ((self->popts & SF_DECOMPRESS))
+        {
+            ssize_t len = pread(fd, head, sizeof(head), 0);
+            codec = sf_content_codec(head, len > 0 ? len : 0);
+        }
+    if (codec == SF_CODEC_PLAIN)
+        {
+            // using magic determine if the file is a text file and count the lines if so,
+            //   see mime.c
+            struct stat info;
+            if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+                {
+                    // a link to a directory or a device, no lines
+                    close(fd);
+                    return 0;
+                }
+            const char *ftype = sf_mime_detect(self, magic, fullpath, fd, &info);
+            if (ftype == NULL)
+                {
+                    close(fd);
+                    return -1;
+                }
+            if (strstr(ftype, "text") == NULL)
+                {
+                    close(fd);
+                    return 0;
+                }
+            lseek(fd, 0, SEEK_SET);
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    switch (codec)
+        {
+        case SF_CODEC_GZIP:
+            ret = sf_lines_gzip(fd, &count);
+            break;
+        case SF_CODEC_XZ:
+            ret = sf_lines_xz(fd, &count);
+            break;
+#ifdef SF_HAVE_ZSTD
+        case SF_CODEC_ZSTD:
+            ret = sf_lines_zstd(fd, &count);
+            break;
+#endif
+        default:
+            ret = sf_lines_plain(fd, &count);
+            break;
+        }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    close(fd);
+
+    // --stats, shared by every thread that counts lines
+    struct sf_codecstats *stats = &self->codecstats[codec];
+    __sync_fetch_and_add(&stats->files, 1);
+    __sync_fetch_and_add(&stats->inbytes, count.inbytes);
+    __sync_fetch_and_add(&stats->outbytes, count.outbytes);
+    __sync_fetch_and_add(&stats->nanos, (stop.tv_sec - start.tv_sec) * 1000000000ULL + stop.tv_nsec - start.tv_nsec);
+
+    if (ret == 0 && !count.binary)
+        {
+            *lines = count.lines;
+        }
+    return ret;
+}
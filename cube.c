@@ -0,0 +1,128 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "summarizefiles.h"
+
+/**
+ * --cube: count every file once into a cell for its (extension, time bucket) pair, with lines
+ * as an extra measure under --lines. The extension and the time views, and either of them
+ * restricted to one value of the other dimension (--where), are rolled up from the cells when
+ * the view is drawn, so one traversal answers all of them.
+ *
+ * A cell key is the extension and the time bucket key joined by SF_CUBE_SEP; its label is the
+ * label of the time bucket.
+ */
+
+/**********************************************************************************************
+ * sf_cube_fillkey: Build the cell key for a file into rec->keybuf from its extension and its
+ *   time bucket key.
+ **********************************************************************************************/
+
+void sf_cube_fillkey(sf_filerec_t *rec, const char *ext, const char *timekey)
+{
+    snprintf(rec->keybuf, sizeof(rec->keybuf), "%s%c%s", ext, SF_CUBE_SEP, timekey);
+    rec->key = rec->keybuf;
+}
+
+/**********************************************************************************************
+ * sf_cube_split: Point *timekey at the time half of a cell key and return the length of the
+ *   extension half.
+ **********************************************************************************************/
+
+size_t sf_cube_split(const char *key, const char **timekey)
+{
+    const char *sep = strchr(key, SF_CUBE_SEP);
+    if (sep == NULL)
+        {
+            *timekey = "";
+            return strlen(key);
+        }
+    *timekey = sep + 1;
+    return sep - key;
+}
+
+/* --where matches a time bucket by its key, its label or its class ("01old", "02year", ...) */
+static int sf_cube_timematch(const char *timekey, const char *label, const char *where)
+{
+    size_t len = strlen(where);
+    return strcmp(timekey, where) == 0 || strcmp(label, where) == 0
+           || (strncmp(timekey, where, len) == 0 && timekey[len] == '.');
+}
+
+/**********************************************************************************************
+ * sf_cube_rollup: Fold the cells into rollup along the dimension being viewed, the time
+ *   buckets with --time and the extensions otherwise, keeping only the cells whose other
+ *   coordinate matches where when it is set. When ci holds confidence intervals for the cells
+ *   it is rewritten for the rolled up groups, adding the cells' errors in quadrature.
+ **********************************************************************************************/
+
+int sf_cube_rollup(sumfiles_t *self, sf_groups_t *cells, sf_groups_t *rollup, const char *where)
+{
+    int bytime = (self->popts & SF_TIME) != 0;
+    double *err = NULL;
+    uint32_t id;
+
+    sf_groups_reset(rollup);
+    if (self->probes > 0)
+        {
+            // squared absolute error per rolled up group, there are never more of those than cells
+            err = calloc(cells->count ? cells->count : 1, sizeof(double));
+            if (err == NULL)
+                {
+                    return -1;
+                }
+        }
+
+    for (id = 0; id < cells->count; id++)
+        {
+            const char *timekey;
+            size_t extlen = sf_cube_split(cells->key[id], &timekey);
+            char ext[extlen + 1];
+            memcpy(ext, cells->key[id], extlen);
+            ext[extlen] = 0;
+
+            if (where != NULL
+                    && (bytime ? strcmp(ext, where) != 0 : !sf_cube_timematch(timekey, cells->label[id], where)))
+                {
+                    continue;
+                }
+
+            int32_t into = bytime ? sf_groups_intern(rollup, timekey, cells->label[id], 1)
+                           : sf_groups_intern(rollup, ext, "", 1);
+            if (into < 0)
+                {
+                    free(err);
+                    return -1;
+                }
+            sf_groups_fold(rollup, into, cells, id);
+            if (err != NULL)
+                {
+                    double measure = (self->popts & SF_LINES) ? cells->lines[id] : cells->bytes[id];
+                    double abserr = self->ci[id] * measure;
+                    err[into] += abserr * abserr;
+                }
+        }
+
+    if (err != NULL)
+        {
+            for (id = 0; id < rollup->count; id++)
+                {
+                    double measure = (self->popts & SF_LINES) ? rollup->lines[id] : rollup->bytes[id];
+                    self->ci[id] = measure > 0 ? sqrt(err[id]) / measure : INFINITY;
+                }
+            free(err);
+        }
+    return 0;
+}
@@ -0,0 +1,381 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "summarizefiles.h"
+
+/**
+ * Compact binary form of a group table, shared by everything that writes aggregates to disk.
+ * The same file handles --dump and the merge subcommand.
+ * Integers are LEB128 varints (zigzag for times), strings are a varint length and the bytes:
+ *
+ *   count, flags, then per group: key, label, bytes, files, lines, min mtime, max mtime
+ *   and with SF_GROUPS_HIST in flags the histogram as the number of non empty buckets
+ *   followed by (bucket, count) pairs, with SF_GROUPS_TOP the top lists, each as its length
+ *   followed by (value, path) pairs
+ */
+
+int sf_putvarint(FILE *out, uint64_t value)
+{
+    unsigned char buf[10];
+    int len = 0;
+    do
+        {
+            buf[len] = value & 0x7f;
+            value >>= 7;
+            if (value)
+                {
+                    buf[len] |= 0x80;
+                }
+            len++;
+        }
+    while (value);
+    return fwrite(buf, 1, len, out) == (size_t)len ? 0 : -1;
+}
+
+int sf_getvarint(FILE *in, uint64_t *value)
+{
+    uint64_t result = 0;
+    int shift = 0, ch;
+    do
+        {
+            ch = getc(in);
+            if (ch == EOF || shift > 63)
+                {
+                    return -1;
+                }
+            result |= (uint64_t)(ch & 0x7f) << shift;
+            shift += 7;
+        }
+    while (ch & 0x80);
+    *value = result;
+    return 0;
+}
+
+int sf_putstring(FILE *out, const char *str)
+{
+    size_t len = strlen(str);
+    if (sf_putvarint(out, len) != 0)
+        {
+            return -1;
+        }
+    return fwrite(str, 1, len, out) == len ? 0 : -1;
+}
+
+/* Reads a string written by sf_putstring, refusing anything that does not fit buf */
+int sf_getstring(FILE *in, char *buf, size_t size)
+{
+    uint64_t len;
+    if (sf_getvarint(in, &len) != 0 || len >= size)
+        {
+            return -1;
+        }
+    if (fread(buf, 1, len, in) != len)
+        {
+            return -1;
+        }
+    buf[len] = 0;
+    return 0;
+}
+
+static int sf_dump_hist(FILE *out, const uint64_t *hist)
+{
+    int bucket, used = 0;
+    for (bucket = 0; bucket < SF_HIST_BUCKETS; bucket++)
+        {
+            used += hist[bucket] != 0;
+        }
+    if (sf_putvarint(out, used) != 0)
+        {
+            return -1;
+        }
+    for (bucket = 0; bucket < SF_HIST_BUCKETS; bucket++)
+        {
+            if (hist[bucket] != 0
+                    && (sf_putvarint(out, bucket) != 0 || sf_putvarint(out, hist[bucket]) != 0))
+                {
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+static int sf_dump_top(FILE *out, sf_groups_t *groups, uint32_t id)
+{
+    int list;
+    uint32_t idx;
+    for (list = 0; list < SF_TOP_LISTS; list++)
+        {
+            const struct sf_topfile *heap = &groups->top[(id * SF_TOP_LISTS + list) * groups->topn];
+            uint32_t used = groups->ntop[id * SF_TOP_LISTS + list];
+            if (sf_putvarint(out, used) != 0)
+                {
+                    return -1;
+                }
+            for (idx = 0; idx < used; idx++)
+                {
+                    if (sf_putvarint(out, SF_ZIGZAG(heap[idx].value)) != 0 || sf_putstring(out, heap[idx].path) != 0)
+                        {
+                            return -1;
+                        }
+                }
+        }
+    return 0;
+}
+
+int sf_dump_groups(FILE *out, sf_groups_t *groups)
+{
+    uint32_t id;
+    int flags = (groups->hist != NULL ? SF_GROUPS_HIST : 0) | (groups->topn > 0 ? SF_GROUPS_TOP : 0);
+    if (sf_putvarint(out, groups->count) != 0 || sf_putvarint(out, flags) != 0)
+        {
+            return -1;
+        }
+    for (id = 0; id < groups->count; id++)
+        {
+            if (sf_putstring(out, groups->key[id]) != 0
+                    || sf_putstring(out, groups->label[id]) != 0
+                    || sf_putvarint(out, groups->bytes[id]) != 0
+                    || sf_putvarint(out, groups->files[id]) != 0
+                    || sf_putvarint(out, groups->lines[id]) != 0
+                    || sf_putvarint(out, SF_ZIGZAG(groups->min_mtime[id])) != 0
+                    || sf_putvarint(out, SF_ZIGZAG(groups->max_mtime[id])) != 0
+                    || ((flags & SF_GROUPS_HIST) && sf_dump_hist(out, &groups->hist[id * SF_HIST_BUCKETS]) != 0)
+                    || ((flags & SF_GROUPS_TOP) && sf_dump_top(out, groups, id) != 0))
+                {
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_load_groups: Add the groups of a dump to groups, copying the keys into its arena.
+ *   Streams the dump, so merging many dumps only ever holds the merged table. Histograms and
+ *   top lists are dropped when groups does not keep them.
+ **********************************************************************************************/
+
+static int sf_load_hist(FILE *in, uint64_t *hist)
+{
+    uint64_t used, bucket, count;
+    if (sf_getvarint(in, &used) != 0)
+        {
+            return -1;
+        }
+    while (used-- > 0)
+        {
+            if (sf_getvarint(in, &bucket) != 0 || sf_getvarint(in, &count) != 0
+                    || bucket >= SF_HIST_BUCKETS)
+                {
+                    return -1;
+                }
+            if (hist != NULL)
+                {
+                    hist[bucket] += count;
+                }
+        }
+    return 0;
+}
+
+static int sf_load_top(FILE *in, sf_groups_t *groups, uint32_t id)
+{
+    int list;
+    for (list = 0; list < SF_TOP_LISTS; list++)
+        {
+            uint64_t used, value;
+            char path[4096];
+            if (sf_getvarint(in, &used) != 0)
+                {
+                    return -1;
+                }
+            while (used-- > 0)
+                {
+                    if (sf_getvarint(in, &value) != 0 || sf_getstring(in, path, sizeof(path)) != 0)
+                        {
+                            return -1;
+                        }
+                    if (groups->topn > 0 && sf_groups_top(groups, id, list, SF_UNZIGZAG(value), path, 1) != 0)
+                        {
+                            return -1;
+                        }
+                }
+        }
+    return 0;
+}
+
+int sf_load_groups(FILE *in, sf_groups_t *groups)
+{
+    uint64_t count, flags, idx;
+    if (sf_getvarint(in, &count) != 0 || sf_getvarint(in, &flags) != 0)
+        {
+            return -1;
+        }
+    for (idx = 0; idx < count; idx++)
+        {
+            char key[4096], label[4096];
+            uint64_t bytes, files, lines, min_mtime, max_mtime;
+            if (sf_getstring(in, key, sizeof(key)) != 0
+                    || sf_getstring(in, label, sizeof(label)) != 0
+                    || sf_getvarint(in, &bytes) != 0
+                    || sf_getvarint(in, &files) != 0
+                    || sf_getvarint(in, &lines) != 0
+                    || sf_getvarint(in, &min_mtime) != 0
+                    || sf_getvarint(in, &max_mtime) != 0)
+                {
+                    return -1;
+                }
+            int32_t id = sf_groups_intern(groups, key, label, 1);
+            if (id < 0)
+                {
+                    return -1;
+                }
+            sf_groups_add(groups, id, bytes, files, lines, SF_UNZIGZAG(min_mtime), SF_UNZIGZAG(max_mtime));
+            if ((flags & SF_GROUPS_HIST)
+                    && sf_load_hist(in, groups->hist != NULL ? &groups->hist[id * SF_HIST_BUCKETS] : NULL) != 0)
+                {
+                    return -1;
+                }
+            if ((flags & SF_GROUPS_TOP) && sf_load_top(in, groups, id) != 0)
+                {
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+/* The options that decide what a dump holds. --cube cells are the same whichever dimension is
+ * viewed, so the view is left out for them */
+#define SF_DUMP_MODES (SF_EXT | SF_TIME | SF_LINES | SF_HIST | SF_CUBE | SF_OWNER | SF_OWNEREXT | SF_MIME)
+
+int sf_dump_modes(int popts)
+{
+    return (popts & SF_CUBE) ? popts & (SF_CUBE | SF_LINES | SF_HIST) : popts & SF_DUMP_MODES;
+}
+
+/**
+ * --dump FILE: the totals of a scan, or of one --shard of it, for the merge subcommand:
+ *
+ *   "SFDP", version, modes, shard, shards, min mtime, max mtime, exceptions, groups
+ */
+
+#define SF_DUMP_MAGIC "SFDP"
+#define SF_DUMP_VERSION 1
+
+int sf_dump_write(sumfiles_t *self, const char *path)
+{
+    sf_groups_t merged;
+    int ret;
+
+    if (sf_groups_init(&merged) != 0)
+        {
+            return -1;
+        }
+    merged.flags = self->snapshot.flags;
+    merged.topn = self->snapshot.topn;
+    ret = sf_groups_collect(self, &merged, NULL);
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL || ret != 0)
+        {
+            perror(path);
+            if (out != NULL)
+                {
+                    fclose(out);
+                }
+            sf_groups_destroy(&merged);
+            return -1;
+        }
+    if (fwrite(SF_DUMP_MAGIC, 1, 4, out) != 4
+            || sf_putvarint(out, SF_DUMP_VERSION) != 0
+            || sf_putvarint(out, sf_dump_modes(self->popts)) != 0
+            || sf_putvarint(out, self->shard) != 0
+            || sf_putvarint(out, self->shards) != 0
+            || sf_putvarint(out, SF_ZIGZAG(self->min_mod_time)) != 0
+            || sf_putvarint(out, SF_ZIGZAG(self->max_mod_time)) != 0
+            || sf_putvarint(out, self->exceptions) != 0
+            || sf_dump_groups(out, &merged) != 0)
+        {
+            ret = -1;
+        }
+    if (fclose(out) != 0 || ret != 0)
+        {
+            perror(path);
+            unlink(path);
+            ret = -1;
+        }
+    sf_groups_destroy(&merged);
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_dump_merge: Add a --dump file to the totals of self. The groups go into the calling
+ *   thread's table and the dump is read as a stream, so merging thousands of them only ever
+ *   holds the merged groups. Called in place of sf_scan, once per dump.
+ **********************************************************************************************/
+
+int sf_dump_merge(sumfiles_t *self, const char *path)
+{
+    snprintf(self->rootpath, sizeof(self->rootpath), "merge of %d dumps", ++self->merged);
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+        {
+            perror(path);
+            return -1;
+        }
+
+    setvbuf(in, NULL, _IOFBF, 64 * 1024);
+    char magic[4];
+    uint64_t version, modes, shard, shards, min_mtime, max_mtime, exceptions;
+    int ret = -1;
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, SF_DUMP_MAGIC, 4) != 0
+            || sf_getvarint(in, &version) != 0 || version != SF_DUMP_VERSION)
+        {
+            fprintf(stderr, "%s: not a dump written by this version\n", path);
+        }
+    else if (sf_getvarint(in, &modes) != 0 || (modes | SF_HIST) != (uint64_t)(sf_dump_modes(self->popts) | SF_HIST)
+             || ((self->popts & SF_HIST) && (modes & SF_HIST) == 0))
+        {
+            // histograms can be dropped but not made up
+            fprintf(stderr, "%s: the dump was written with different options\n", path);
+        }
+    else if (sf_getvarint(in, &shard) == 0
+             && sf_getvarint(in, &shards) == 0
+             && sf_getvarint(in, &min_mtime) == 0
+             && sf_getvarint(in, &max_mtime) == 0
+             && sf_getvarint(in, &exceptions) == 0)
+        {
+            sf_groups_t *groups = sf_localgroups(self);
+            if (groups != NULL)
+                {
+                    pthread_mutex_lock(&groups->lock);
+                    ret = sf_load_groups(in, groups);
+                    pthread_mutex_unlock(&groups->lock);
+                }
+            if ((time_t)SF_UNZIGZAG(min_mtime) < self->min_mod_time)
+                {
+                    self->min_mod_time = SF_UNZIGZAG(min_mtime);
+                }
+            if ((time_t)SF_UNZIGZAG(max_mtime) > self->max_mod_time)
+                {
+                    self->max_mod_time = SF_UNZIGZAG(max_mtime);
+                }
+            self->exceptions += exceptions;
+            if (ret != 0)
+                {
+                    fprintf(stderr, "%s: dump is truncated\n", path);
+                }
+        }
+    fclose(in);
+    return ret;
+}
@@ -0,0 +1,626 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include "summarizefiles.h"
+
+/**
+ * --dupes: find files with the same content and count, per group, the bytes their extra
+ * copies take up, i.e. what could be reclaimed by keeping one of each. The scan only notes
+ * the non-empty files (their size, inode and name, the directory name shared by its files);
+ * the content is compared once the scan is done, in stages that each read more of fewer files:
+ *
+ *   1. size: while scanning, the files are bucketed by size in a table with one slot per size
+ *      that holds the first file of that size. A file becomes a candidate only once its size
+ *      repeats, so a file of a size nothing else has never gets past its slot. After the scan
+ *      the candidates are sorted by size and the extra names of a hard linked file are
+ *      dropped, they take no space of their own.
+ *   2. partial hash: the first and last SF_DUPES_EDGE bytes of each remaining file, which
+ *      tells most same sized files apart (and is the whole file for small ones).
+ *   3. full hash: only files whose size and partial hash are still shared are read in full.
+ *
+ * Files left with the same size and full hash are copies; the first is kept and every other
+ * one adds its size to its own group. The hashing is spread over as many threads as its
+ * tuner (tune.c) finds worth it, or --workers, each reading through one chunk buffer, and
+ * every stage compacts the list it got, so memory is a slot per distinct size, the list of
+ * candidates and a chunk per thread. The names of the files are kept in an arena either way.
+ */
+
+#define SF_DUPES_EDGE  (4 * 1024)
+#define SF_DUPES_GROW  4096
+
+/* candidate states */
+#define SF_DUPE_PARTIAL 1        // hash is of the whole content, the file is small
+#define SF_DUPE_DROPPED 2        // could not be read, or changed since the scan
+
+struct sf_dupfile
+{
+    uint64_t size;
+    dev_t dev;
+    ino_t ino;
+    const char *dir;         // with its trailing '/', shared by the files of a directory
+    const char *name;
+    const char *ext;
+    int32_t extid;
+    int state;
+    uint64_t hash[2];
+};
+
+/* the size table, the first file of a size waits here until another one has the size */
+struct sf_dupslot
+{
+    uint64_t size;           // 0 for a free slot, empty files are not noted
+    dev_t dev;
+    ino_t ino;
+    const char *dir;
+    const char *name;        // NULL once the size repeated and the file is a candidate
+};
+
+struct sf_dupes
+{
+    struct sf_dupfile *files;
+    size_t count;
+    size_t size;
+    sf_arena_t arena;        // the directory and file names
+    const char *lastdir;
+    struct sf_dupslot *slots;
+    size_t nslots;           // a power of two
+    size_t usedslots;
+
+    // the hashing, shared by the workers
+    sumfiles_t *owner;
+    int full;
+    sf_tune_t *tune;
+
+    uint64_t noted;          // --stats
+    uint64_t partial;
+    uint64_t hashed;
+    uint64_t hashedbytes;
+    uint64_t copies;
+    uint64_t reclaimable;
+};
+
+/**********************************************************************************************
+ * sf_dupes_new: The candidate list of a --dupes scan, filled by sf_dupes_add.
+ **********************************************************************************************/
+
+sf_dupes_t *sf_dupes_new(void)
+{
+    return calloc(1, sizeof(sf_dupes_t)); // freed by sf_dupes_destroy
+}
+
+/* MurmurHash3's finalizer, spreads the sizes over the size table and the content hashes */
+static uint64_t sf_dupes_fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Put a file whose size is shared on the candidate list, name is in the arena already */
+static int sf_dupes_candidate(sf_dupes_t *dupes, uint64_t size, dev_t dev, ino_t ino, const char *dir,
+                              const char *name)
+{
+    char keybuf[NAME_MAX + 1];
+
+    if (dupes->count == dupes->size)
+        {
+            size_t grow = dupes->size ? dupes->size * 2 : SF_DUPES_GROW;
+            struct sf_dupfile *files = realloc(dupes->files, grow * sizeof(struct sf_dupfile));
+            if (files == NULL)
+                {
+                    return -1;
+                }
+            dupes->files = files;
+            dupes->size = grow;
+        }
+
+    struct sf_dupfile *file = &dupes->files[dupes->count];
+    file->name = name;
+    file->size = size;
+    file->dev = dev;
+    file->ino = ino;
+    file->dir = dir;
+    file->extid = sf_ext_intern(name, keybuf, sizeof(keybuf), &file->ext);
+    if (file->extid < 0)
+        {
+            // the name is in keybuf, keep a copy
+            file->ext = sf_arena_strdup(&dupes->arena, file->ext);
+            if (file->ext == NULL)
+                {
+                    return -1;
+                }
+        }
+    file->state = 0;
+    file->hash[0] = file->hash[1] = 0;
+    dupes->count++;
+    return 0;
+}
+
+/* The slot of size, free when the size was not seen yet. Grows the table at half full */
+static struct sf_dupslot *sf_dupes_slot(sf_dupes_t *dupes, uint64_t size)
+{
+    size_t idx;
+
+    if (2 * (dupes->usedslots + 1) > dupes->nslots)
+        {
+            size_t nslots = dupes->nslots ? dupes->nslots * 2 : SF_DUPES_GROW;
+            struct sf_dupslot *slots = calloc(nslots, sizeof(struct sf_dupslot));
+            if (slots == NULL)
+                {
+                    return NULL;
+                }
+            for (idx = 0; idx < dupes->nslots; idx++)
+                {
+                    if (dupes->slots[idx].size != 0)
+                        {
+                            size_t at = sf_dupes_fmix(dupes->slots[idx].size) & (nslots - 1);
+                            while (slots[at].size != 0)
+                                {
+                                    at = (at + 1) & (nslots - 1);
+                                }
+                            slots[at] = dupes->slots[idx];
+                        }
+                }
+            free(dupes->slots);
+            dupes->slots = slots;
+            dupes->nslots = nslots;
+        }
+    idx = sf_dupes_fmix(size) & (dupes->nslots - 1);
+    while (dupes->slots[idx].size != 0 && dupes->slots[idx].size != size)
+        {
+            idx = (idx + 1) & (dupes->nslots - 1);
+        }
+    return &dupes->slots[idx];
+}
+
+/**********************************************************************************************
+ * sf_dupes_add: Note a file for the comparison after the scan. Called from the traversal
+ *   only, in the order fts hands out the files, so a directory's name is kept once for all
+ *   the files in it.
+ **********************************************************************************************/
+
+int sf_dupes_add(sf_dupes_t *dupes, const char *fullpath, const char *basefile, const struct stat *info)
+{
+    size_t dirlen = strlen(fullpath) - strlen(basefile);
+
+    if (info->st_size == 0 || !S_ISREG(info->st_mode))
+        {
+            // nothing to reclaim, a symbolic link takes no room of its target's
+            return 0;
+        }
+    if (dupes->lastdir == NULL || strncmp(dupes->lastdir, fullpath, dirlen) != 0 || dupes->lastdir[dirlen] != 0)
+        {
+            char *dir = sf_arena_alloc(&dupes->arena, dirlen + 1);
+            if (dir == NULL)
+                {
+                    return -1;
+                }
+            memcpy(dir, fullpath, dirlen);
+            dir[dirlen] = 0;
+            dupes->lastdir = dir;
+        }
+    const char *name = sf_arena_strdup(&dupes->arena, basefile);
+    struct sf_dupslot *slot = sf_dupes_slot(dupes, info->st_size);
+    if (name == NULL || slot == NULL)
+        {
+            return -1;
+        }
+    dupes->noted++;
+
+    if (slot->size == 0)
+        {
+            // the first of its size, it waits in the slot
+            slot->size = info->st_size;
+            slot->dev = info->st_dev;
+            slot->ino = info->st_ino;
+            slot->dir = dupes->lastdir;
+            slot->name = name;
+            dupes->usedslots++;
+            return 0;
+        }
+    if (slot->name != NULL)
+        {
+            // the size repeats, the first file of it is a candidate now too
+            if (sf_dupes_candidate(dupes, slot->size, slot->dev, slot->ino, slot->dir, slot->name) != 0)
+                {
+                    return -1;
+                }
+            slot->name = NULL;
+        }
+    return sf_dupes_candidate(dupes, info->st_size, info->st_dev, info->st_ino, dupes->lastdir, name);
+}
+
+/* 128 bit hash of the content, MurmurHash3 x64 128 fed 16 bytes at a time */
+struct sf_dupehash
+{
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t len;
+};
+
+#define SF_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+#define SF_MURMUR_C1 0x87c37b91114253d5ULL
+#define SF_MURMUR_C2 0x4cf5ad432745937fULL
+
+/* Hash len bytes of buf, all but the last call of a hash get a multiple of 16 */
+static void sf_dupes_hashbuf(struct sf_dupehash *st, const unsigned char *buf, size_t len)
+{
+    size_t at;
+    uint64_t k1, k2;
+
+    for (at = 0; at + 16 <= len; at += 16)
+        {
+            memcpy(&k1, buf + at, 8);
+            memcpy(&k2, buf + at + 8, 8);
+            k1 *= SF_MURMUR_C1;
+            k1 = SF_ROTL64(k1, 31);
+            k1 *= SF_MURMUR_C2;
+            st->h1 ^= k1;
+            st->h1 = SF_ROTL64(st->h1, 27);
+            st->h1 += st->h2;
+            st->h1 = st->h1 * 5 + 0x52dce729;
+            k2 *= SF_MURMUR_C2;
+            k2 = SF_ROTL64(k2, 33);
+            k2 *= SF_MURMUR_C1;
+            st->h2 ^= k2;
+            st->h2 = SF_ROTL64(st->h2, 31);
+            st->h2 += st->h1;
+            st->h2 = st->h2 * 5 + 0x38495ab5;
+        }
+    if (at < len)
+        {
+            // the tail, zero padded
+            unsigned char tail[16] = { 0 };
+            memcpy(tail, buf + at, len - at);
+            memcpy(&k1, tail, 8);
+            memcpy(&k2, tail + 8, 8);
+            k2 *= SF_MURMUR_C2;
+            k2 = SF_ROTL64(k2, 33);
+            k2 *= SF_MURMUR_C1;
+            st->h2 ^= k2;
+            k1 *= SF_MURMUR_C1;
+            k1 = SF_ROTL64(k1, 31);
+            k1 *= SF_MURMUR_C2;
+            st->h1 ^= k1;
+        }
+    st->len += len;
+}
+
+static void sf_dupes_hashend(struct sf_dupehash *st, uint64_t *hash)
+{
+    uint64_t h1 = st->h1 ^ st->len, h2 = st->h2 ^ st->len;
+    h1 += h2;
+    h2 += h1;
+    h1 = sf_dupes_fmix(h1);
+    h2 = sf_dupes_fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+/* Read len bytes at offset into the hash, in chunks of size. -1 when the file came up short */
+static int sf_dupes_hashrange(sumfiles_t *self, int fd, struct sf_dupehash *st, char *buf, size_t size,
+                              uint64_t offset, uint64_t len)
+{
+    while (len > 0)
+        {
+            size_t want = len < size ? len : size;
+            size_t got = 0;
+            while (got < want)
+                {
+                    uint64_t start = sf_throttle_begin(self->throttle, want - got);
+                    ssize_t n = pread(fd, buf + got, want - got, offset + got);
+                    sf_throttle_end(self->throttle, start, n > 0 ? want - got - n : want - got);
+                    if (n <= 0)
+                        {
+                            return -1;
+                        }
+                    got += n;
+                }
+            sf_dupes_hashbuf(st, (unsigned char *)buf, want);
+            offset += want;
+            len -= want;
+        }
+    return 0;
+}
+
+/* Hash one candidate, the edges of it or all of it. Returns the bytes read, -1 on failure */
+static int64_t sf_dupes_hashfile(sumfiles_t *self, struct sf_dupfile *file, int full, char *buf)
+{
+    char path[PATH_MAX];
+    struct stat info;
+    struct sf_dupehash st = { 0x9368e53c2f6af274ULL, 0x586dcd208f7cd3fdULL, 0 };
+    int64_t bytes;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s%s", file->dir, file->name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        {
+            return -1;
+        }
+    if (fstat(fd, &info) != 0 || info.st_ino != file->ino || info.st_dev != file->dev
+            || (uint64_t)info.st_size != file->size)
+        {
+            // replaced or changed since the scan
+            close(fd);
+            return -1;
+        }
+    if (full)
+        {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            bytes = file->size;
+            ret = sf_dupes_hashrange(self, fd, &st, buf, SF_CONTENT_CHUNK, 0, file->size);
+        }
+    else if (file->size <= 2 * SF_DUPES_EDGE)
+        {
+            bytes = file->size;
+            ret = sf_dupes_hashrange(self, fd, &st, buf, SF_CONTENT_CHUNK, 0, file->size);
+            file->state |= SF_DUPE_PARTIAL;
+        }
+    else
+        {
+            bytes = 2 * SF_DUPES_EDGE;
+            ret = sf_dupes_hashrange(self, fd, &st, buf, SF_DUPES_EDGE, 0, SF_DUPES_EDGE);
+            if (ret == 0)
+                {
+                    ret = sf_dupes_hashrange(self, fd, &st, buf, SF_DUPES_EDGE, file->size - SF_DUPES_EDGE,
+                                             SF_DUPES_EDGE);
+                }
+        }
+    close(fd);
+    if (ret != 0)
+        {
+            return -1;
+        }
+    sf_dupes_hashend(&st, file->hash);
+    return bytes;
+}
+
+/* Hash one candidate for sf_tune_run, returns the bytes read */
+static uint64_t sf_dupes_hashone(void *arg, size_t idx)
+{
+    sf_dupes_t *dupes = arg;
+    struct sf_dupfile *file = &dupes->files[idx];
+    char buf[SF_CONTENT_CHUNK];
+
+    if (dupes->full && (file->state & SF_DUPE_PARTIAL))
+        {
+            // the partial hash read it all
+            return 0;
+        }
+    int64_t bytes = sf_dupes_hashfile(dupes->owner, file, dupes->full, buf);
+    if (bytes < 0)
+        {
+            file->state |= SF_DUPE_DROPPED;
+            __sync_fetch_and_add(&dupes->owner->exceptions, 1);
+            return 0;
+        }
+    __sync_fetch_and_add(dupes->full ? &dupes->hashed : &dupes->partial, 1);
+    __sync_fetch_and_add(&dupes->hashedbytes, bytes);
+    return bytes;
+}
+
+/* Hash every candidate, as many at once as the tuner finds pays, or inline without one */
+static void sf_dupes_hashall(sf_dupes_t *dupes, int full)
+{
+    size_t idx;
+
+    dupes->full = full;
+    if (dupes->tune != NULL)
+        {
+            sf_tune_run(dupes->tune, dupes->count, sf_dupes_hashone, dupes);
+            return;
+        }
+    for (idx = 0; idx < dupes->count; idx++)
+        {
+            sf_dupes_hashone(dupes, idx);
+        }
+}
+
+static int sf_dupes_compare_inode(const void *a, const void *b)
+{
+    const struct sf_dupfile *f1 = a, *f2 = b;
+    if (f1->size != f2->size)
+        {
+            return f1->size < f2->size ? -1 : 1;
+        }
+    if (f1->dev != f2->dev)
+        {
+            return f1->dev < f2->dev ? -1 : 1;
+        }
+    return (f1->ino > f2->ino) - (f1->ino < f2->ino);
+}
+
+static int sf_dupes_compare_hash(const void *a, const void *b)
+{
+    const struct sf_dupfile *f1 = a, *f2 = b;
+    if (f1->size != f2->size)
+        {
+            return f1->size < f2->size ? -1 : 1;
+        }
+    if (f1->hash[0] != f2->hash[0])
+        {
+            return f1->hash[0] < f2->hash[0] ? -1 : 1;
+        }
+    if (f1->hash[1] != f2->hash[1])
+        {
+            return f1->hash[1] < f2->hash[1] ? -1 : 1;
+        }
+    return sf_dupes_compare_inode(a, b);
+}
+
+/* Two candidates are alike when they have the same size, and the same hash after a stage */
+static int sf_dupes_alike(const struct sf_dupfile *f1, const struct sf_dupfile *f2, int hashed)
+{
+    return f1->size == f2->size && (!hashed || (f1->hash[0] == f2->hash[0] && f1->hash[1] == f2->hash[1]));
+}
+
+/* Keep the candidates that are alike to another one, in order, dropping the failed ones */
+static void sf_dupes_compact(sf_dupes_t *dupes, int hashed)
+{
+    size_t idx, kept = 0, run = 0;
+
+    for (idx = 0; idx < dupes->count; idx++)
+        {
+            if ((dupes->files[idx].state & SF_DUPE_DROPPED))
+                {
+                    continue;
+                }
+            dupes->files[kept++] = dupes->files[idx];
+        }
+    dupes->count = kept;
+
+    kept = 0;
+    for (idx = 0; idx < dupes->count; idx = run)
+        {
+            for (run = idx + 1; run < dupes->count && sf_dupes_alike(&dupes->files[idx], &dupes->files[run], hashed); run++)
+                ;
+            if (run - idx > 1)
+                {
+                    memmove(&dupes->files[kept], &dupes->files[idx], (run - idx) * sizeof(struct sf_dupfile));
+                    kept += run - idx;
+                }
+        }
+    dupes->count = kept;
+
+    if (dupes->count < dupes->size / 4)
+        {
+            size_t size = dupes->count > SF_DUPES_GROW ? dupes->count : SF_DUPES_GROW;
+            struct sf_dupfile *files = realloc(dupes->files, size * sizeof(struct sf_dupfile));
+            if (files != NULL)
+                {
+                    dupes->files = files;
+                    dupes->size = size;
+                }
+        }
+}
+
+/**********************************************************************************************
+ * sf_dupes_resolve: Once the scan is done, find the copies among the files noted and add
+ *   their bytes to the dupbytes and dupfiles of their groups, in the calling thread's table.
+ *   The candidates are used up, another call finds nothing new.
+ **********************************************************************************************/
+
+int sf_dupes_resolve(sumfiles_t *self, sf_dupes_t *dupes)
+{
+    size_t idx, kept = 0;
+
+    // the scan is done, no size repeats any more
+    free(dupes->slots);
+    dupes->slots = NULL;
+    dupes->nslots = dupes->usedslots = 0;
+
+    // 1. by size, without the extra names of a hard linked file
+    qsort(dupes->files, dupes->count, sizeof(struct sf_dupfile), sf_dupes_compare_inode);
+    for (idx = 0; idx < dupes->count; idx++)
+        {
+            if (kept > 0 && dupes->files[kept - 1].dev == dupes->files[idx].dev
+                    && dupes->files[kept - 1].ino == dupes->files[idx].ino)
+                {
+                    continue;
+                }
+            dupes->files[kept++] = dupes->files[idx];
+        }
+    dupes->count = kept;
+    sf_dupes_compact(dupes, 0);
+
+    // 2. the edges of the files that share a size. Every hashing thread holds one file open
+    dupes->owner = self;
+    if (dupes->tune == NULL)
+        {
+            int workers = self->config.workers;
+            dupes->tune = sf_tune_new("hash", workers > 0 ? workers : sf_tune_cpus(),
+                                      workers > 0 ? workers : sf_tune_cap(1), workers > 0);
+        }
+    sf_dupes_hashall(dupes, 0);
+    qsort(dupes->files, dupes->count, sizeof(struct sf_dupfile), sf_dupes_compare_hash);
+    sf_dupes_compact(dupes, 1);
+
+    // 3. all of the files whose edges are alike too
+    sf_dupes_hashall(dupes, 1);
+    qsort(dupes->files, dupes->count, sizeof(struct sf_dupfile), sf_dupes_compare_hash);
+    sf_dupes_compact(dupes, 1);
+
+    sf_groups_t *groups = sf_localgroups(self);
+    if (groups == NULL)
+        {
+            __sync_fetch_and_add(&self->exceptions, 1);
+            return -1;
+        }
+    pthread_mutex_lock(&groups->lock);
+    for (idx = 0; idx < dupes->count; idx++)
+        {
+            const struct sf_dupfile *file = &dupes->files[idx];
+            if (idx == 0 || !sf_dupes_alike(&dupes->files[idx - 1], file, 1))
+                {
+                    // the one copy kept
+                    continue;
+                }
+            int32_t id = file->extid >= 0 ? sf_groups_internext(groups, file->extid, file->ext)
+                         : sf_groups_intern(groups, file->ext, "", 1);
+            if (id < 0)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    continue;
+                }
+            groups->dupbytes[id] += file->size;
+            groups->dupfiles[id]++;
+            dupes->copies++;
+            dupes->reclaimable += file->size;
+        }
+    pthread_mutex_unlock(&groups->lock);
+
+    dupes->count = 0;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_dupes_stats: --stats, how far the files got through the stages, on stderr.
+ **********************************************************************************************/
+
+void sf_dupes_stats(sf_dupes_t *dupes)
+{
+    char sbuf[32];
+    if (dupes == NULL)
+        {
+            return;
+        }
+    fprintf(stderr, "dupes  %10" PRIu64 " files noted, %" PRIu64 " edges hashed, %" PRIu64 " hashed in full,"
+            " %s read\n", dupes->noted, dupes->partial, dupes->hashed, show_size(sbuf, dupes->hashedbytes));
+    fprintf(stderr, "dupes  %10" PRIu64 " copies, %s reclaimable\n", dupes->copies,
+            show_size(sbuf, dupes->reclaimable));
+    sf_tune_stats(dupes->tune);
+}
+
+void sf_dupes_destroy(sf_dupes_t *dupes)
+{
+    if (dupes == NULL)
+        {
+            return;
+        }
+    sf_tune_destroy(dupes->tune);
+    sf_arena_free(&dupes->arena);
+    free(dupes->slots);
+    free(dupes->files);
+    free(dupes);
+}
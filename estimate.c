@@ -0,0 +1,466 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "summarizefiles.h"
+
+/**
+ * --estimate: while sf_scan walks a root, a second thread keeps taking random walks from the
+ * root down to a leaf directory. At each level one subdirectory is picked uniformly and the
+ * walk's weight is multiplied by the number of subdirectories there (Knuth's estimator), so
+ * weight * (what a visited directory holds) summed along the walk is an unbiased estimate of
+ * the whole tree. The mean over many walks, on top of the exact totals of the roots scanned
+ * before, is shown with a 95% confidence interval until the scan of the root finishes and its
+ * exact totals take over. The walks skip the top level entries of other shards.
+ *
+ * With --lines or --by-mime the walks read file content as the scan does. They then pause
+ * SF_ESTIMATE_PAUSE times as long as each directory took, so the sampler gets at most a
+ * small share of the disk next to the scan.
+ *
+ * The walking thread is the only one that interns keys or grows the arrays, so it reads them
+ * without the lock. It holds the lock only to add a group and to fold a finished walk into
+ * sum and sumsq, never across directory reads, stats or file content.
+ */
+
+#define SF_ESTIMATE_MEASURES 3   // bytes, files, lines
+#define SF_ESTIMATE_Z 1.96
+#define SF_ESTIMATE_PAUSE 3
+
+struct sf_estimate
+{
+    sumfiles_t *owner;
+    pthread_t thread;
+    pthread_mutex_t lock;    // keys, size, sum, sumsq, min_mtime, max_mtime and probes
+    int stop;                // atomic, see sf_estimate_stopped
+
+    char *root;
+    sf_groups_t base;        // exact totals of the roots scanned before this one
+    magic_t magic;           // libmagic handles are not shared between threads
+    uint64_t rng;
+
+    sf_groups_t keys;        // interns the group keys, only key/label are used
+    size_t size;
+    double *sum[SF_ESTIMATE_MEASURES];
+    double *sumsq[SF_ESTIMATE_MEASURES];
+    double *probe[SF_ESTIMATE_MEASURES];
+    uint64_t *stamp;         // probe number that last touched the group
+    uint32_t *touched;
+    size_t ntouched;
+    time_t *walkmin;         // the mtimes seen by the walk in progress
+    time_t *walkmax;
+    time_t *min_mtime;
+    time_t *max_mtime;
+    uint64_t probes;
+};
+
+static int sf_estimate_stopped(sf_estimate_t *est)
+{
+    return __atomic_load_n(&est->stop, __ATOMIC_ACQUIRE);
+}
+
+static uint64_t sf_estimate_random(sf_estimate_t *est)
+{
+    // xorshift64*
+    est->rng ^= est->rng >> 12;
+    est->rng ^= est->rng << 25;
+    est->rng ^= est->rng >> 27;
+    return est->rng * 2685821657736338717UL;
+}
+
+static int sf_estimate_grow(sf_estimate_t *est)
+{
+    size_t size = est->size ? est->size * 2 : 256;
+    int m;
+    for (m = 0; m < SF_ESTIMATE_MEASURES; m++)
+        {
+            double *sum = realloc(est->sum[m], size * sizeof(double));
+            double *sumsq = realloc(est->sumsq[m], size * sizeof(double));
+            double *probe = realloc(est->probe[m], size * sizeof(double));
+            if (sum) est->sum[m] = sum;
+            if (sumsq) est->sumsq[m] = sumsq;
+            if (probe) est->probe[m] = probe;
+            if (sum == NULL || sumsq == NULL || probe == NULL)
+                {
+                    return -1;
+                }
+            memset(est->sum[m] + est->size, 0, (size - est->size) * sizeof(double));
+            memset(est->sumsq[m] + est->size, 0, (size - est->size) * sizeof(double));
+        }
+    uint64_t *stamp = realloc(est->stamp, size * sizeof(uint64_t));
+    uint32_t *touched = realloc(est->touched, size * sizeof(uint32_t));
+    time_t *walkmin = realloc(est->walkmin, size * sizeof(time_t));
+    time_t *walkmax = realloc(est->walkmax, size * sizeof(time_t));
+    time_t *min_mtime = realloc(est->min_mtime, size * sizeof(time_t));
+    time_t *max_mtime = realloc(est->max_mtime, size * sizeof(time_t));
+    if (stamp) est->stamp = stamp;
+    if (touched) est->touched = touched;
+    if (walkmin) est->walkmin = walkmin;
+    if (walkmax) est->walkmax = walkmax;
+    if (min_mtime) est->min_mtime = min_mtime;
+    if (max_mtime) est->max_mtime = max_mtime;
+    if (stamp == NULL || touched == NULL || walkmin == NULL || walkmax == NULL
+            || min_mtime == NULL || max_mtime == NULL)
+        {
+            return -1;
+        }
+    memset(est->stamp + est->size, 0, (size - est->size) * sizeof(uint64_t));
+    size_t idx;
+    for (idx = est->size; idx < size; idx++)
+        {
+            // no walk has folded the group in yet
+            est->min_mtime[idx] = LONG_MAX;
+            est->max_mtime[idx] = LONG_MIN;
+        }
+    est->size = size;
+    return 0;
+}
+
+/* Count one file seen by the current walk, weighted by the fan-out above its directory */
+static void sf_estimate_file(sf_estimate_t *est, const sf_filerec_t *rec, double weight)
+{
+    int32_t id = sf_groups_find(&est->keys, rec->key);
+    if (id < 0)
+        {
+            // a new group changes what sf_estimate_fill reads
+            pthread_mutex_lock(&est->lock);
+            id = sf_groups_intern(&est->keys, rec->key, rec->label, 1);
+            if (id >= 0 && (size_t)id >= est->size && sf_estimate_grow(est) != 0)
+                {
+                    id = -1;
+                }
+            pthread_mutex_unlock(&est->lock);
+        }
+    if (id < 0 || (size_t)id >= est->size)
+        {
+            return;
+        }
+
+    uint64_t probe = est->probes + 1;
+    if (est->stamp[id] != probe)
+        {
+            est->stamp[id] = probe;
+            est->touched[est->ntouched++] = id;
+            est->probe[0][id] = 0;
+            est->probe[1][id] = 0;
+            est->probe[2][id] = 0;
+            est->walkmin[id] = rec->mtime;
+            est->walkmax[id] = rec->mtime;
+        }
+    est->probe[0][id] += weight * rec->bytes;
+    est->probe[1][id] += weight;
+    est->probe[2][id] += weight * rec->lines;
+    if (est->walkmin[id] > rec->mtime)
+        {
+            est->walkmin[id] = rec->mtime;
+        }
+    if (est->walkmax[id] < rec->mtime)
+        {
+            est->walkmax[id] = rec->mtime;
+        }
+}
+
+/**********************************************************************************************
+ * sf_estimate_probe: One random walk. Every file of every directory on the walk is counted,
+ *   then the walk continues into a random subdirectory.
+ **********************************************************************************************/
+
+static void sf_estimate_probe(sf_estimate_t *est)
+{
+    char path[PATH_MAX];
+    double weight = 1;
+    size_t len;
+    int depth = 0;
+    int content = (est->owner->popts & (SF_LINES | SF_MIME)) != 0;
+
+    snprintf(path, sizeof(path), "%s", est->root);
+    len = strlen(path);
+    est->ntouched = 0;
+
+    while (!sf_estimate_stopped(est))
+        {
+            struct timespec start, stop;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            DIR *dir = opendir(path);
+            if (dir == NULL)
+                {
+                    break;
+                }
+
+            struct dirent *dent;
+            long nsubdirs = 0;
+            char pick[NAME_MAX + 1];
+            while ((dent = readdir(dir)) != NULL)
+                {
+                    if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0
+                            || (depth == 0 && sf_othershard(est->owner, dent->d_name)))
+                        {
+                            continue;
+                        }
+
+                    char fullpath[PATH_MAX];
+                    struct stat info;
+                    int plen = snprintf(fullpath, sizeof(fullpath), "%s%s%s", path, path[len - 1] == '/' ? "" : "/",
+                                        dent->d_name);
+                    if (plen < 0 || (size_t)plen >= sizeof(fullpath))
+                        {
+                            // cut short it would name some other file, the scan cannot open it either
+                            continue;
+                        }
+                    uint64_t start = sf_throttle_begin(est->owner->throttle, 0);
+                    int ret = fstatat(dirfd(dir), dent->d_name, &info, AT_SYMLINK_NOFOLLOW);
+                    sf_throttle_end(est->owner->throttle, start, 0);
+                    if (ret != 0)
+                        {
+                            continue;
+                        }
+
+                    if (S_ISDIR(info.st_mode))
+                        {
+                            // reservoir sampling picks a subdirectory uniformly in one pass
+                            nsubdirs++;
+                            if (sf_estimate_random(est) % nsubdirs == 0)
+                                {
+                                    snprintf(pick, sizeof(pick), "%s", dent->d_name);
+                                }
+                            continue;
+                        }
+
+                    sf_filerec_t rec;
+                    if (sf_fillrec(est->owner, &est->magic, fullpath, dent->d_name, &info, &rec) == 0)
+                        {
+                            if (rec.key == NULL)
+                                {
+                                    sf_owner_fillkey(&rec);
+                                }
+                            sf_estimate_file(est, &rec, weight);
+                        }
+                }
+            closedir(dir);
+
+            if (nsubdirs == 0 || len + strlen(pick) + 2 >= sizeof(path))
+                {
+                    break;
+                }
+            weight *= nsubdirs;
+            len += snprintf(path + len, sizeof(path) - len, "%s%s", path[len - 1] == '/' ? "" : "/", pick);
+            depth++;
+
+            if (content)
+                {
+                    // leave the disk to the scan most of the time
+                    clock_gettime(CLOCK_MONOTONIC, &stop);
+                    uint64_t took = (stop.tv_sec - start.tv_sec) * 1000000000ULL + stop.tv_nsec - start.tv_nsec;
+                    uint64_t pause = took * SF_ESTIMATE_PAUSE;
+                    struct timespec delay = { pause / 1000000000ULL, pause % 1000000000ULL };
+                    nanosleep(&delay, NULL);
+                }
+        }
+
+    if (!sf_estimate_stopped(est))
+        {
+            size_t idx;
+            int m;
+            pthread_mutex_lock(&est->lock);
+            for (idx = 0; idx < est->ntouched; idx++)
+                {
+                    uint32_t id = est->touched[idx];
+                    for (m = 0; m < SF_ESTIMATE_MEASURES; m++)
+                        {
+                            est->sum[m][id] += est->probe[m][id];
+                            est->sumsq[m][id] += est->probe[m][id] * est->probe[m][id];
+                        }
+                    if (est->min_mtime[id] > est->walkmin[id])
+                        {
+                            est->min_mtime[id] = est->walkmin[id];
+                        }
+                    if (est->max_mtime[id] < est->walkmax[id])
+                        {
+                            est->max_mtime[id] = est->walkmax[id];
+                        }
+                }
+            est->probes++;
+            pthread_mutex_unlock(&est->lock);
+        }
+}
+
+static void *sf_estimate_run(void *arg)
+{
+    sf_estimate_t *est = (sf_estimate_t *)arg;
+    while (!sf_estimate_stopped(est))
+        {
+            sf_estimate_probe(est);
+        }
+    return NULL;
+}
+
+/**********************************************************************************************
+ * sf_estimate_start: Start sampling root in the background, called by sf_scan before it walks
+ *   the root. What the scan counted so far is taken as exact.
+ **********************************************************************************************/
+
+sf_estimate_t *sf_estimate_start(sumfiles_t *self, const char *root)
+{
+    sf_estimate_t *est = calloc(1, sizeof(sf_estimate_t)); // freed by sf_estimate_destroy
+    if (est == NULL)
+        {
+            return NULL;
+        }
+    if (sf_groups_init(&est->keys) != 0)
+        {
+            free(est);
+            return NULL;
+        }
+    if (sf_groups_init(&est->base) != 0)
+        {
+            sf_groups_destroy(&est->keys);
+            free(est);
+            return NULL;
+        }
+    pthread_mutex_init(&est->lock, NULL);
+    est->owner = self;
+    est->root = strdup(root);
+    if (est->root == NULL || sf_groups_collect(self, &est->base, NULL) != 0)
+        {
+            __atomic_store_n(&est->stop, 1, __ATOMIC_RELEASE);
+            sf_estimate_destroy(est);
+            return NULL;
+        }
+    est->rng = ((uint64_t)time(NULL) << 20) ^ (uint64_t)(uintptr_t)est ^ 0x9E3779B97F4A7C15UL;
+
+    if (pthread_create(&est->thread, NULL, sf_estimate_run, est) != 0)
+        {
+            __atomic_store_n(&est->stop, 1, __ATOMIC_RELEASE);
+            sf_estimate_destroy(est);
+            return NULL;
+        }
+    return est;
+}
+
+/**********************************************************************************************
+ * sf_estimate_fill: Put the exact totals of the earlier roots and the current estimates into
+ *   the snapshot, rounded to whole units, and their 95% confidence half width relative to the
+ *   total into ci. Returns the number of walks taken so far, 0 when there is nothing to show.
+ **********************************************************************************************/
+
+uint64_t sf_estimate_fill(sf_estimate_t *est, sf_groups_t *snapshot, double **ci, size_t *cisize, int measure)
+{
+    pthread_mutex_lock(&est->lock);
+    uint64_t n = est->probes;
+    if (n == 0)
+        {
+            pthread_mutex_unlock(&est->lock);
+            return 0;
+        }
+
+    // the snapshot holds at most the groups of both
+    size_t need = est->base.count + est->keys.count;
+    if (*cisize < need)
+        {
+            double *grown = realloc(*ci, need * sizeof(double));
+            if (grown == NULL)
+                {
+                    pthread_mutex_unlock(&est->lock);
+                    return 0;
+                }
+            *ci = grown;
+            *cisize = need;
+        }
+    if (sf_groups_merge(snapshot, &est->base) != 0)
+        {
+            pthread_mutex_unlock(&est->lock);
+            return 0;
+        }
+    uint32_t id;
+    for (id = 0; id < snapshot->count; id++)
+        {
+            (*ci)[id] = 0;
+        }
+
+    for (id = 0; id < est->keys.count && id < est->size; id++)
+        {
+            if (est->sum[1][id] == 0)
+                {
+                    // only seen by the walk in progress
+                    continue;
+                }
+            int32_t into = sf_groups_intern(snapshot, est->keys.key[id], est->keys.label[id], 0);
+            if (into < 0)
+                {
+                    break;
+                }
+            double exact = measure == 2 ? snapshot->lines[into] : snapshot->bytes[into];
+            sf_groups_add(snapshot, into, llround(est->sum[0][id] / n), llround(est->sum[1][id] / n),
+                          llround(est->sum[2][id] / n), est->min_mtime[id], est->max_mtime[id]);
+
+            double mean = est->sum[measure][id] / n;
+            double half = INFINITY;
+            if (n > 1 && mean > 0)
+                {
+                    double var = (est->sumsq[measure][id] - est->sum[measure][id] * mean) / (n - 1);
+                    half = SF_ESTIMATE_Z * sqrt((var > 0 ? var : 0) / n) / (exact + mean);
+                }
+            (*ci)[into] = half;
+        }
+    pthread_mutex_unlock(&est->lock);
+    return n;
+}
+
+void sf_estimate_stop(sf_estimate_t *est)
+{
+    if (est != NULL && !sf_estimate_stopped(est))
+        {
+            __atomic_store_n(&est->stop, 1, __ATOMIC_RELEASE);
+            pthread_join(est->thread, NULL);
+        }
+}
+
+void sf_estimate_destroy(sf_estimate_t *est)
+{
+    int m;
+    if (est == NULL)
+        {
+            return;
+        }
+    sf_estimate_stop(est);
+    for (m = 0; m < SF_ESTIMATE_MEASURES; m++)
+        {
+            free(est->sum[m]);
+            free(est->sumsq[m]);
+            free(est->probe[m]);
+        }
+    free(est->stamp);
+    free(est->touched);
+    free(est->walkmin);
+    free(est->walkmax);
+    free(est->min_mtime);
+    free(est->max_mtime);
+    if (est->magic != NULL)
+        {
+            magic_close(est->magic);
+        }
+    sf_groups_destroy(&est->keys);
+    sf_groups_destroy(&est->base);
+    pthread_mutex_destroy(&est->lock);
+    free(est->root);
+    free(est);
+}
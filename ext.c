@@ -0,0 +1,202 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <string.h>
+#include "summarizefiles.h"
+#include "exttab.h"
+
+/**
+ * Extensions: a file's extension is normalized to lower case, so x.JPG and x.jpg are one
+ * group, and compound extensions listed in exttab.txt (tar.gz) are kept whole. Every
+ * normalized extension is interned into a small integer id with a canonical name that lives
+ * as long as the process, which lets the group tables find an extension's group by id
+ * (sf_groups_internext) instead of hashing and comparing its name for every file.
+ *
+ * The few hundred common extensions are compiled into a perfect hash table (exttab.h, made
+ * by mkexttab from exttab.txt). The rest are interned at run time into a fallback table
+ * shared by all scans of the process; it is looked up under a read lock and only written the
+ * first time an extension is seen, and each thread keeps the ones it saw last in a small
+ * cache in front of it. The fallback table stops taking extensions at SF_EXT_OTHERS, so a
+ * long running process that scans trees full of one-off suffixes (.20240101-1234) stays
+ * bounded; the extensions after that have no id and are grouped by their name.
+ */
+
+#define SF_EXT_OTHERS 4096
+
+static pthread_rwlock_t sf_ext_lock = PTHREAD_RWLOCK_INITIALIZER;
+static sf_groups_t sf_ext_fallback;
+static int sf_ext_ready = 0;
+
+/* The id of a lower case extension in the generated table, -1 when it is not there. ext is
+ * padded with zeros to SF_EXT_MAXLEN + 1 like the names in the table, the compare is then a
+ * couple of word compares instead of a call to strcmp. */
+static int32_t sf_ext_known(const char *ext, uint64_t hash)
+{
+    uint32_t displace = sf_exttab_displace[hash & (SF_EXTTAB_BUCKETS - 1)];
+    uint32_t slot = sf_exttab_slots[SF_EXTTAB_SLOT(hash, displace, SF_EXTTAB_SLOTS - 1)];
+    if (slot != 0 && memcmp(sf_exttab_names[slot - 1], ext, SF_EXT_MAXLEN + 1) == 0)
+        {
+            return slot - 1;
+        }
+    return -1;
+}
+
+/* The fallback extensions a thread saw last, by hash, so it rarely takes the lock */
+#define SF_EXT_CACHE 64
+
+struct sf_extcache
+{
+    uint64_t hash;
+    int32_t id;
+    const char *name;
+};
+
+static __thread struct sf_extcache sf_ext_cache[SF_EXT_CACHE];
+
+/* The id of an extension not in the generated table, interning it the first time */
+static int32_t sf_ext_other(const char *ext, uint64_t hash, const char **name)
+{
+    struct sf_extcache *cached = &sf_ext_cache[hash & (SF_EXT_CACHE - 1)];
+    int32_t id = -1;
+
+    if (cached->name != NULL && cached->hash == hash && strcmp(cached->name, ext) == 0)
+        {
+            *name = cached->name;
+            return cached->id;
+        }
+
+    pthread_rwlock_rdlock(&sf_ext_lock);
+    if (sf_ext_ready)
+        {
+            id = sf_groups_find(&sf_ext_fallback, ext);
+            if (id >= 0)
+                {
+                    *name = sf_ext_fallback.key[id];
+                }
+            else if (sf_ext_fallback.count >= SF_EXT_OTHERS)
+                {
+                    // full, the name stays in the caller's keybuf
+                    pthread_rwlock_unlock(&sf_ext_lock);
+                    return -1;
+                }
+        }
+    pthread_rwlock_unlock(&sf_ext_lock);
+
+    if (id < 0)
+        {
+            pthread_rwlock_wrlock(&sf_ext_lock);
+            if (!sf_ext_ready && sf_groups_init(&sf_ext_fallback) == 0)
+                {
+                    sf_ext_ready = 1;
+                }
+            if (sf_ext_ready)
+                {
+                    // another thread may have filled it up, or added ext, since the read lock
+                    id = sf_groups_find(&sf_ext_fallback, ext);
+                    if (id < 0 && sf_ext_fallback.count < SF_EXT_OTHERS)
+                        {
+                            id = sf_groups_intern(&sf_ext_fallback, ext, "", 1);
+                        }
+                    if (id >= 0)
+                        {
+                            *name = sf_ext_fallback.key[id];
+                        }
+                }
+            pthread_rwlock_unlock(&sf_ext_lock);
+            if (id < 0)
+                {
+                    return -1;
+                }
+        }
+
+    cached->hash = hash;
+    cached->id = SF_EXTTAB_COUNT + id;
+    cached->name = *name;
+    return cached->id;
+}
+
+/**********************************************************************************************
+ * sf_ext_intern: Return the id of basefile's normalized extension and point *name at its
+ *   canonical spelling, "" (SF_EXT_NONE) when the file has none. keybuf is scratch space for
+ *   the lower case extension; when the fallback table can not take it, because it is full or
+ *   out of memory, *name is left there and -1 is returned.
+ **********************************************************************************************/
+
+int32_t sf_ext_intern(const char *basefile, char *keybuf, size_t size, const char **name)
+{
+    const char *dot = strrchr(basefile, '.');
+    if (dot == NULL || dot == basefile || dot[1] == 0)
+        {
+            // No extension, filename is just a dot, or ends in one
+            *name = sf_exttab_names[SF_EXT_NONE];
+            return SF_EXT_NONE;
+        }
+
+    // lower case into keybuf, hashing as it goes
+    uint64_t hash = SF_FNV_BASIS;
+    size_t len;
+    memset(keybuf, 0, SF_EXT_MAXLEN + 1);
+    for (len = 0; dot[len + 1] != 0 && len + 1 < size; len++)
+        {
+            char c = dot[len + 1];
+            c = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+            keybuf[len] = c;
+            hash = SF_FNV_STEP(hash, c);
+        }
+    keybuf[len] = 0;
+
+    int32_t id = len <= SF_EXT_MAXLEN ? sf_ext_known(keybuf, hash) : -1;
+    if (id < 0)
+        {
+            *name = keybuf;
+            return sf_ext_other(keybuf, hash, name);
+        }
+    *name = sf_exttab_names[id];
+    if (!sf_exttab_tails[id])
+        {
+            return id;
+        }
+
+    // gz, xz, ...: the part before may make it a compound extension, tar.gz
+    const char *prev = dot - 1;
+    while (prev > basefile && *prev != '.')
+        {
+            prev--;
+        }
+    if (prev > basefile && (size_t)(dot - prev) + len <= SF_EXT_MAXLEN)
+        {
+            char compound[SF_EXT_MAXLEN + 1] = { 0 };
+            size_t at;
+            hash = SF_FNV_BASIS;
+            for (at = 0; prev + 1 + at < dot; at++)
+                {
+                    char c = prev[1 + at];
+                    c = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+                    compound[at] = c;
+                    hash = SF_FNV_STEP(hash, c);
+                }
+            compound[at++] = '.';
+            hash = SF_FNV_STEP(hash, '.');
+            strcpy(compound + at, keybuf);
+            for (; compound[at] != 0; at++)
+                {
+                    hash = SF_FNV_STEP(hash, compound[at]);
+                }
+            int32_t whole = sf_ext_known(compound, hash);
+            if (whole >= 0)
+                {
+                    *name = sf_exttab_names[whole];
+                    return whole;
+                }
+        }
+    return id;
+}
@@ -0,0 +1,578 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "summarizefiles.h"
+
+/**
+ * Group tables: the aggregation state for one scanning thread. A group is interned once into a
+ * small integer id and its statistics live in one array per statistic, indexed by that id.
+ * Keys and labels come from the table's arena, so tearing a table down costs a handful of
+ * frees no matter how many groups it holds.
+ */
+
+#define SF_GROUPS_INITIAL 1024
+#define SF_GROUPS_COLUMNS 256
+
+static __thread sf_groups_t *sf_thread_groups = NULL;
+static __thread unsigned long sf_thread_scan = 0;
+
+unsigned long sf_hashkey(const char *key)
+{
+    unsigned long hash = SF_FNV_BASIS;
+    while (*key)
+        {
+            hash = SF_FNV_STEP(hash, *key++);
+        }
+    return hash;
+}
+
+/* Set flags such as SF_GROUPS_HIST and topn on a table right after sf_groups_init, before it is used */
+int sf_groups_init(sf_groups_t *groups)
+{
+    memset(groups, 0, sizeof(sf_groups_t));
+    groups->slots = calloc(SF_GROUPS_INITIAL, sizeof(uint32_t)); // freed by sf_groups_destroy
+    if (groups->slots == NULL)
+        {
+            return -1;
+        }
+    groups->capacity = SF_GROUPS_INITIAL;
+    pthread_mutex_init(&groups->lock, NULL);
+    return 0;
+}
+
+#define SF_GROW_COLUMN(col, size) \
+    do { \
+        void *p = realloc((col), (size) * sizeof(*(col))); \
+        if (p == NULL) return -1; \
+        (col) = p; \
+    } while (0)
+
+static int sf_groups_growcolumns(sf_groups_t *groups)
+{
+    size_t size = groups->size ? groups->size * 2 : SF_GROUPS_COLUMNS;
+
+    SF_GROW_COLUMN(groups->key, size);
+    SF_GROW_COLUMN(groups->label, size);
+    SF_GROW_COLUMN(groups->hash, size);
+    SF_GROW_COLUMN(groups->bytes, size);
+    SF_GROW_COLUMN(groups->files, size);
+    SF_GROW_COLUMN(groups->lines, size);
+    SF_GROW_COLUMN(groups->min_mtime, size);
+    SF_GROW_COLUMN(groups->max_mtime, size);
+    if ((groups->flags & SF_GROUPS_HIST))
+        {
+            SF_GROW_COLUMN(groups->hist, size * SF_HIST_BUCKETS);
+        }
+    if (groups->topn > 0)
+        {
+            SF_GROW_COLUMN(groups->top, size * SF_TOP_LISTS * groups->topn);
+            SF_GROW_COLUMN(groups->ntop, size * SF_TOP_LISTS);
+        }
+    if ((groups->flags & SF_GROUPS_DUPES))
+        {
+            SF_GROW_COLUMN(groups->dupbytes, size);
+            SF_GROW_COLUMN(groups->dupfiles, size);
+        }
+    groups->size = size;
+    return 0;
+}
+
+static int sf_groups_growslots(sf_groups_t *groups)
+{
+    size_t capacity = groups->capacity * 2;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL)
+        {
+            return -1;
+        }
+
+    uint32_t id;
+    for (id = 0; id < groups->count; id++)
+        {
+            size_t idx = groups->hash[id] & (capacity - 1);
+            while (slots[idx] != 0)
+                {
+                    idx = (idx + 1) & (capacity - 1);
+                }
+            slots[idx] = id + 1;
+        }
+
+    free(groups->slots);
+    groups->slots = slots;
+    groups->capacity = capacity;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_groups_intern: Return the id of the group for key, creating an empty group if this is the
+ *   first time it is seen. With copy set the key and label are copied into the arena,
+ *   otherwise the caller guarantees they outlive the table (used when merging tables).
+ *   Returns -1 when memory runs out.
+ **********************************************************************************************/
+
+int32_t sf_groups_intern(sf_groups_t *groups, const char *key, const char *label, int copy)
+{
+    unsigned long hash = sf_hashkey(key);
+    size_t idx = hash & (groups->capacity - 1);
+    uint32_t slot;
+
+    while ((slot = groups->slots[idx]) != 0)
+        {
+            if (groups->hash[slot - 1] == hash && strcmp(groups->key[slot - 1], key) == 0)
+                {
+                    return slot - 1;
+                }
+            idx = (idx + 1) & (groups->capacity - 1);
+        }
+
+    if (groups->count == groups->size && sf_groups_growcolumns(groups) != 0)
+        {
+            return -1;
+        }
+    if ((groups->count + 1) * 10 > groups->capacity * 7)
+        {
+            if (sf_groups_growslots(groups) != 0)
+                {
+                    return -1;
+                }
+            idx = hash & (groups->capacity - 1);
+            while (groups->slots[idx] != 0)
+                {
+                    idx = (idx + 1) & (groups->capacity - 1);
+                }
+        }
+
+    uint32_t id = groups->count;
+    if (label == NULL)
+        {
+            label = "";
+        }
+    if (copy)
+        {
+            key = sf_arena_strdup(&groups->arena, key);
+            label = label[0] ? sf_arena_strdup(&groups->arena, label) : "";
+            if (key == NULL || label == NULL)
+                {
+                    return -1;
+                }
+        }
+
+    groups->key[id] = key;
+    groups->label[id] = label;
+    groups->hash[id] = hash;
+    groups->bytes[id] = 0;
+    groups->files[id] = 0;
+    groups->lines[id] = 0;
+    groups->min_mtime[id] = LONG_MAX;
+    groups->max_mtime[id] = 0;
+    if (groups->hist != NULL)
+        {
+            memset(&groups->hist[id * SF_HIST_BUCKETS], 0, SF_HIST_BUCKETS * sizeof(uint64_t));
+        }
+    if (groups->ntop != NULL)
+        {
+            memset(&groups->ntop[id * SF_TOP_LISTS], 0, SF_TOP_LISTS * sizeof(uint32_t));
+        }
+    if (groups->dupbytes != NULL)
+        {
+            groups->dupbytes[id] = 0;
+            groups->dupfiles[id] = 0;
+        }
+    groups->slots[idx] = id + 1;
+    groups->count++;
+
+    return id;
+}
+
+/**********************************************************************************************
+ * sf_groups_find: Return the id of the group for key, or -1 when there is none.
+ **********************************************************************************************/
+
+int32_t sf_groups_find(sf_groups_t *groups, const char *key)
+{
+    unsigned long hash = sf_hashkey(key);
+    size_t idx = hash & (groups->capacity - 1);
+    uint32_t slot;
+
+    while ((slot = groups->slots[idx]) != 0)
+        {
+            if (groups->hash[slot - 1] == hash && strcmp(groups->key[slot - 1], key) == 0)
+                {
+                    return slot - 1;
+                }
+            idx = (idx + 1) & (groups->capacity - 1);
+        }
+    return -1;
+}
+
+/**********************************************************************************************
+ * sf_groups_internext: sf_groups_intern for a key that is the extension with the given id
+ *   (see ext.c). After the first file of an extension its group is an array lookup, without
+ *   hashing the key. The key is borrowed, extension names live as long as the process.
+ **********************************************************************************************/
+
+int32_t sf_groups_internext(sf_groups_t *groups, int32_t ext, const char *key)
+{
+    if ((size_t)ext < groups->byextsize && groups->byext[ext] != 0)
+        {
+            return groups->byext[ext] - 1;
+        }
+
+    int32_t id = sf_groups_intern(groups, key, "", 0);
+    if (id < 0)
+        {
+            return -1;
+        }
+    if ((size_t)ext >= groups->byextsize)
+        {
+            size_t size = groups->byextsize ? groups->byextsize * 2 : SF_GROUPS_COLUMNS;
+            while (size <= (size_t)ext)
+                {
+                    size *= 2;
+                }
+            uint32_t *byext = realloc(groups->byext, size * sizeof(uint32_t));
+            if (byext == NULL)
+                {
+                    // still counted, by key
+                    return id;
+                }
+            memset(byext + groups->byextsize, 0, (size - groups->byextsize) * sizeof(uint32_t));
+            groups->byext = byext;
+            groups->byextsize = size;
+        }
+    groups->byext[ext] = id + 1;
+    return id;
+}
+
+/* The slot of an owner key, free when the table has no group for it yet */
+static struct sf_ownerslot *sf_groups_ownerslot(struct sf_ownerslot *slots, size_t size, uint64_t owner, int32_t ext)
+{
+    size_t at = (owner * 0x9E3779B97F4A7C15ULL ^ (uint32_t)ext) * 0x9E3779B97F4A7C15ULL >> 32;
+    for (at &= size - 1; slots[at].id != 0; at = (at + 1) & (size - 1))
+        {
+            if (slots[at].owner == owner && slots[at].ext == ext)
+                {
+                    break;
+                }
+        }
+    return &slots[at];
+}
+
+/**********************************************************************************************
+ * sf_groups_internowner: sf_groups_intern for a --by-owner file whose key was not built,
+ *   looked up by its uid, gid and extension id instead. Only the first file of a group has
+ *   its key built, by sf_owner_fillkey, and hashed.
+ **********************************************************************************************/
+
+int32_t sf_groups_internowner(sf_groups_t *groups, sf_filerec_t *rec)
+{
+    if (groups->byownersize > 0)
+        {
+            struct sf_ownerslot *slot = sf_groups_ownerslot(groups->byowner, groups->byownersize, rec->owner, rec->ext);
+            if (slot->id != 0)
+                {
+                    return slot->id - 1;
+                }
+        }
+
+    sf_owner_fillkey(rec);
+    int32_t id = sf_groups_intern(groups, rec->key, "", 1);
+    if (id < 0)
+        {
+            return -1;
+        }
+    if (2 * (groups->byownercount + 1) > groups->byownersize)
+        {
+            size_t size = groups->byownersize ? groups->byownersize * 2 : SF_GROUPS_COLUMNS;
+            struct sf_ownerslot *slots = calloc(size, sizeof(struct sf_ownerslot));
+            if (slots == NULL)
+                {
+                    // still counted, by key
+                    return id;
+                }
+            size_t at;
+            for (at = 0; at < groups->byownersize; at++)
+                {
+                    if (groups->byowner[at].id != 0)
+                        {
+                            const struct sf_ownerslot *old = &groups->byowner[at];
+                            *sf_groups_ownerslot(slots, size, old->owner, old->ext) = *old;
+                        }
+                }
+            free(groups->byowner);
+            groups->byowner = slots;
+            groups->byownersize = size;
+        }
+    struct sf_ownerslot *slot = sf_groups_ownerslot(groups->byowner, groups->byownersize, rec->owner, rec->ext);
+    slot->owner = rec->owner;
+    slot->ext = rec->ext;
+    slot->id = id + 1;
+    groups->byownercount++;
+    return id;
+}
+
+void sf_groups_add(sf_groups_t *groups, uint32_t id, uint64_t bytes, uint64_t files, uint64_t lines,
+                   time_t min_mtime, time_t max_mtime)
+{
+    groups->bytes[id] += bytes;
+    groups->files[id] += files;
+    groups->lines[id] += lines;
+    if (groups->min_mtime[id] > min_mtime)
+        {
+            groups->min_mtime[id] = min_mtime;
+        }
+    if (groups->max_mtime[id] < max_mtime)
+        {
+            groups->max_mtime[id] = max_mtime;
+        }
+}
+
+/**********************************************************************************************
+ * sf_groups_top: Offer a file to one of the top lists of a group. The heap keeps the topn
+ *   largest values with the smallest at the root, so most files are turned away by a single
+ *   comparison, and only files that make the list have their path copied into the arena
+ *   (borrowed instead without copy, as in sf_groups_intern).
+ **********************************************************************************************/
+
+int sf_groups_top(sf_groups_t *groups, uint32_t id, int list, int64_t value, const char *path, int copy)
+{
+    struct sf_topfile *heap = &groups->top[(id * SF_TOP_LISTS + list) * groups->topn];
+    uint32_t *used = &groups->ntop[id * SF_TOP_LISTS + list];
+    uint32_t idx;
+
+    if (*used == (uint32_t)groups->topn && value <= heap[0].value)
+        {
+            return 0;
+        }
+    if (copy)
+        {
+            path = sf_arena_strdup(&groups->arena, path);
+            if (path == NULL)
+                {
+                    return -1;
+                }
+        }
+
+    if (*used < (uint32_t)groups->topn)
+        {
+            // sift up from the new leaf
+            idx = (*used)++;
+            while (idx > 0 && heap[(idx - 1) / 2].value > value)
+                {
+                    heap[idx] = heap[(idx - 1) / 2];
+                    idx = (idx - 1) / 2;
+                }
+        }
+    else
+        {
+            // replace the root and sift down
+            idx = 0;
+            for (;;)
+                {
+                    uint32_t child = idx * 2 + 1;
+                    if (child >= *used)
+                        {
+                            break;
+                        }
+                    if (child + 1 < *used && heap[child + 1].value < heap[child].value)
+                        {
+                            child++;
+                        }
+                    if (heap[child].value >= value)
+                        {
+                            break;
+                        }
+                    heap[idx] = heap[child];
+                    idx = child;
+                }
+        }
+    heap[idx].value = value;
+    heap[idx].path = path;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_groups_fold: Add everything group id of src holds to group into of dst: the counters,
+ *   the histogram, the copies found by --dupes and the top lists, whose paths are borrowed
+ *   from src.
+ **********************************************************************************************/
+
+void sf_groups_fold(sf_groups_t *dst, uint32_t into, sf_groups_t *src, uint32_t id)
+{
+    sf_groups_add(dst, into, src->bytes[id], src->files[id], src->lines[id],
+                  src->min_mtime[id], src->max_mtime[id]);
+    if (dst->hist != NULL && src->hist != NULL)
+        {
+            uint64_t *from = &src->hist[id * SF_HIST_BUCKETS];
+            uint64_t *to = &dst->hist[into * SF_HIST_BUCKETS];
+            int bucket;
+            for (bucket = 0; bucket < SF_HIST_BUCKETS; bucket++)
+                {
+                    to[bucket] += from[bucket];
+                }
+        }
+    if (dst->dupbytes != NULL && src->dupbytes != NULL)
+        {
+            dst->dupbytes[into] += src->dupbytes[id];
+            dst->dupfiles[into] += src->dupfiles[id];
+        }
+    if (dst->topn > 0 && src->topn > 0)
+        {
+            int list;
+            uint32_t idx;
+            for (list = 0; list < SF_TOP_LISTS; list++)
+                {
+                    const struct sf_topfile *heap = &src->top[(id * SF_TOP_LISTS + list) * src->topn];
+                    for (idx = 0; idx < src->ntop[id * SF_TOP_LISTS + list]; idx++)
+                        {
+                            sf_groups_top(dst, into, list, heap[idx].value, heap[idx].path, 0);
+                        }
+                }
+        }
+}
+
+/**********************************************************************************************
+ * sf_groups_merge: Fold the counters of src into dst. The keys are borrowed from src, which
+ *   is fine as long as dst is reset or destroyed before src goes away.
+ **********************************************************************************************/
+
+int sf_groups_merge(sf_groups_t *dst, sf_groups_t *src)
+{
+    uint32_t id;
+    for (id = 0; id < src->count; id++)
+        {
+            int32_t into = sf_groups_intern(dst, src->key[id], src->label[id], 0);
+            if (into < 0)
+                {
+                    return -1;
+                }
+            sf_groups_fold(dst, into, src, id);
+        }
+    return 0;
+}
+
+void sf_groups_reset(sf_groups_t *groups)
+{
+    memset(groups->slots, 0, groups->capacity * sizeof(uint32_t));
+    if (groups->byext != NULL)
+        {
+            memset(groups->byext, 0, groups->byextsize * sizeof(uint32_t));
+        }
+    if (groups->byowner != NULL)
+        {
+            memset(groups->byowner, 0, groups->byownersize * sizeof(struct sf_ownerslot));
+            groups->byownercount = 0;
+        }
+    groups->count = 0;
+    sf_arena_reset(&groups->arena);
+}
+
+void sf_groups_destroy(sf_groups_t *groups)
+{
+    sf_arena_free(&groups->arena);
+    free(groups->slots);
+    free(groups->key);
+    free(groups->label);
+    free(groups->hash);
+    free(groups->bytes);
+    free(groups->files);
+    free(groups->lines);
+    free(groups->min_mtime);
+    free(groups->max_mtime);
+    free(groups->hist);
+    free(groups->top);
+    free(groups->ntop);
+    free(groups->dupbytes);
+    free(groups->dupfiles);
+    free(groups->byext);
+    free(groups->byowner);
+    pthread_mutex_destroy(&groups->lock);
+    memset(groups, 0, sizeof(sf_groups_t));
+}
+
+/**********************************************************************************************
+ * sf_groups_collect: Merge the tables of every thread of the scan into dst, taking each
+ *   table's lock in turn. The keys are borrowed as in sf_groups_merge. With inflight set the
+ *   paths of the pool jobs not yet counted into the tables are written to it, see checkpoint.c.
+ **********************************************************************************************/
+
+int sf_groups_collect(sumfiles_t *self, sf_groups_t *dst, FILE *inflight)
+{
+    sf_groups_t *groups;
+    int ret = 0;
+
+    pthread_mutex_lock(&self->lock);
+    for (groups = self->groups; groups != NULL && ret == 0; groups = groups->chain)
+        {
+            pthread_mutex_lock(&groups->lock);
+            ret = sf_groups_merge(dst, groups);
+            if (ret == 0 && inflight != NULL && groups->counting != NULL)
+                {
+                    ret = sf_putstring(inflight, groups->counting);
+                }
+            pthread_mutex_unlock(&groups->lock);
+        }
+    pthread_mutex_unlock(&self->lock);
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_localgroups: Return the group table owned by the calling thread for this scan, creating
+ *   and registering it with the scan on first use. Only the owning thread writes to it; the
+ *   view takes the table lock while it merges the tables into a snapshot. The last table used
+ *   is cached per thread, a content worker going back and forth between scans finds its table
+ *   in the scan's chain.
+ **********************************************************************************************/
+
+sf_groups_t *sf_localgroups(sumfiles_t *self)
+{
+    if (sf_thread_groups != NULL && sf_thread_scan == self->scan_id)
+        {
+            return sf_thread_groups;
+        }
+
+    sf_groups_t *groups;
+    pthread_mutex_lock(&self->lock);
+    for (groups = self->groups; groups != NULL; groups = groups->chain)
+        {
+            if (pthread_equal(groups->thread, pthread_self()))
+                {
+                    break;
+                }
+        }
+    pthread_mutex_unlock(&self->lock);
+
+    if (groups == NULL)
+        {
+            groups = malloc(sizeof(sf_groups_t)); // freed by sf_close
+            if (groups == NULL || sf_groups_init(groups) != 0)
+                {
+                    free(groups);
+                    return NULL;
+                }
+            groups->flags = self->snapshot.flags;
+            groups->topn = self->snapshot.topn;
+            groups->thread = pthread_self();
+
+            pthread_mutex_lock(&self->lock);
+            groups->chain = self->groups;
+            self->groups = groups;
+            pthread_mutex_unlock(&self->lock);
+        }
+
+    sf_thread_groups = groups;
+    sf_thread_scan = self->scan_id;
+    return groups;
+}
@@ -0,0 +1,792 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+/* qsort_r */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "summarizefiles.h"
+
+/**
+ * --history FILE: every run appends its group totals to FILE, one row per group, and the
+ * history subcommand compares runs. The file is a short header followed by one block per run:
+ *
+ *   struct sf_histrun, the root, the keys first used by this run (key, label), then
+ *   the columns ids, bytes, files, lines, min mtime, max mtime, each as its byte length
+ *   and its varints
+ *
+ * Rows are sorted by key id, the id column holds the gaps between ids. A key's id is its
+ * position in the dictionary made of the keys of all blocks in order. The value columns
+ * hold zigzag differences to the value the same group had in the previous run (0 when it
+ * was not there), except in every SF_HISTORY_KEYFRAME-th run, which holds the values
+ * themselves. A tree that changes a little between runs costs a byte or two per group, and
+ * any run is decoded from the last keyframe before it. Blocks are padded to 8 bytes so the
+ * headers can be read in place from a mapping of the file.
+ */
+
+#define SF_HISTORY_MAGIC "SFHS"
+#define SF_HISTORY_VERSION 1
+#define SF_HISTORY_KEYFRAME 32
+#define SF_HISTORY_COLUMNS 6
+
+struct sf_histrun
+{
+    char magic[4];           // "SFHR"
+    uint32_t keyframe;
+    uint64_t size;           // bytes of the block after this header
+    int64_t when;
+    uint32_t modes;
+    uint32_t ngroups;
+    uint32_t nkeys;          // keys first used by this run
+    uint32_t reserved;
+};
+
+struct sf_history
+{
+    const unsigned char *map;
+    size_t size;
+    size_t end;              // where the last whole run ends, the next one is written there
+    const struct sf_histrun **runs;
+    size_t nruns;
+
+    sf_groups_t keys;        // the dictionary, its columns hold the values of the run decoded
+    uint32_t *stamp;         // per key: index + 1 of the last decoded run it was in
+    size_t stampsize;
+    long decoded;            // run the columns hold, -1 for none
+};
+
+static int sf_memvarint(const unsigned char **pos, const unsigned char *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    int shift = 0;
+    unsigned char ch;
+    do
+        {
+            if (*pos >= end || shift > 63)
+                {
+                    return -1;
+                }
+            ch = *(*pos)++;
+            result |= (uint64_t)(ch & 0x7f) << shift;
+            shift += 7;
+        }
+    while (ch & 0x80);
+    *value = result;
+    return 0;
+}
+
+/* Copies a length prefixed string out of the mapping into buf */
+static int sf_memstring(const unsigned char **pos, const unsigned char *end, char *buf, size_t size)
+{
+    uint64_t len;
+    if (sf_memvarint(pos, end, &len) != 0 || len >= size || len > (uint64_t)(end - *pos))
+        {
+            return -1;
+        }
+    memcpy(buf, *pos, len);
+    buf[len] = 0;
+    *pos += len;
+    return 0;
+}
+
+static int sf_history_growstamp(struct sf_history *hist)
+{
+    if (hist->stampsize >= hist->keys.count)
+        {
+            return 0;
+        }
+    size_t size = hist->keys.size;
+    uint32_t *stamp = realloc(hist->stamp, size * sizeof(uint32_t));
+    if (stamp == NULL)
+        {
+            return -1;
+        }
+    memset(stamp + hist->stampsize, 0, (size - hist->stampsize) * sizeof(uint32_t));
+    hist->stamp = stamp;
+    hist->stampsize = size;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_history_open: Map a history file and index its runs, reading their dictionaries. An
+ *   empty file, or one cut short while its header was written, is a history without runs.
+ **********************************************************************************************/
+
+static int sf_history_open(struct sf_history *hist, int fd, const char *path)
+{
+    struct stat info;
+    size_t cap = 0;
+
+    memset(hist, 0, sizeof(struct sf_history));
+    hist->decoded = -1;
+    if (sf_groups_init(&hist->keys) != 0 || fstat(fd, &info) != 0)
+        {
+            perror(path);
+            return -1;
+        }
+    hist->size = info.st_size;
+    if (hist->size == 0)
+        {
+            return 0;
+        }
+    hist->map = mmap(NULL, hist->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (hist->map == MAP_FAILED)
+        {
+            hist->map = NULL;
+            perror(path);
+            return -1;
+        }
+    char header[8] = SF_HISTORY_MAGIC;
+    *(uint32_t *)(header + 4) = SF_HISTORY_VERSION;
+    if (hist->size < sizeof(header) && memcmp(hist->map, header, hist->size) == 0)
+        {
+            // the first run crashed while writing the header
+            return 0;
+        }
+    if (hist->size < sizeof(header) || memcmp(hist->map, header, sizeof(header)) != 0)
+        {
+            fprintf(stderr, "%s: not a history written by this version\n", path);
+            return -1;
+        }
+
+    size_t off = sizeof(header);
+    hist->end = off;
+    while (off + sizeof(struct sf_histrun) <= hist->size)
+        {
+            const struct sf_histrun *run = (const struct sf_histrun *)(hist->map + off);
+            if (memcmp(run->magic, "SFHR", 4) != 0 || run->size > hist->size - off - sizeof(struct sf_histrun))
+                {
+                    // a run cut short by a crash, everything before it is fine
+                    fprintf(stderr, "%s: ignoring a damaged run at offset %zu\n", path, off);
+                    break;
+                }
+            if (hist->nruns == cap)
+                {
+                    cap = cap ? cap * 2 : 64;
+                    const struct sf_histrun **runs = realloc(hist->runs, cap * sizeof(*runs));
+                    if (runs == NULL)
+                        {
+                            return -1;
+                        }
+                    hist->runs = runs;
+                }
+            hist->runs[hist->nruns++] = run;
+
+            const unsigned char *pos = (const unsigned char *)(run + 1);
+            const unsigned char *end = pos + run->size;
+            char key[4096], label[4096];
+            uint32_t idx;
+            if (sf_memstring(&pos, end, key, sizeof(key)) != 0)
+                {
+                    return -1;
+                }
+            for (idx = 0; idx < run->nkeys; idx++)
+                {
+                    if (sf_memstring(&pos, end, key, sizeof(key)) != 0
+                            || sf_memstring(&pos, end, label, sizeof(label)) != 0
+                            || sf_groups_intern(&hist->keys, key, label, 1) < 0)
+                        {
+                            return -1;
+                        }
+                }
+            off += sizeof(struct sf_histrun) + run->size;
+            hist->end = off;
+        }
+    return sf_history_growstamp(hist);
+}
+
+static void sf_history_close(struct sf_history *hist)
+{
+    if (hist->map != NULL)
+        {
+            munmap((void *)hist->map, hist->size);
+        }
+    free(hist->runs);
+    free(hist->stamp);
+    sf_groups_destroy(&hist->keys);
+}
+
+/* Apply one run to the values held in the dictionary columns */
+static int sf_history_apply(struct sf_history *hist, size_t idx)
+{
+    const struct sf_histrun *run = hist->runs[idx];
+    const unsigned char *pos = (const unsigned char *)(run + 1);
+    const unsigned char *end = pos + run->size;
+    const unsigned char *col[SF_HISTORY_COLUMNS], *colend[SF_HISTORY_COLUMNS];
+    char skip[4096];
+    uint64_t len;
+    uint32_t key, row;
+    int c;
+
+    // the root and the dictionary were read by sf_history_open
+    if (sf_memstring(&pos, end, skip, sizeof(skip)) != 0)
+        {
+            return -1;
+        }
+    for (key = 0; key < 2 * run->nkeys; key++)
+        {
+            if (sf_memstring(&pos, end, skip, sizeof(skip)) != 0)
+                {
+                    return -1;
+                }
+        }
+    for (c = 0; c < SF_HISTORY_COLUMNS; c++)
+        {
+            if (sf_memvarint(&pos, end, &len) != 0 || len > (uint64_t)(end - pos))
+                {
+                    return -1;
+                }
+            col[c] = pos;
+            colend[c] = pos + len;
+            pos += len;
+        }
+
+    uint64_t id = 0;
+    for (row = 0; row < run->ngroups; row++)
+        {
+            uint64_t gap, delta[SF_HISTORY_COLUMNS - 1];
+            if (sf_memvarint(&col[0], colend[0], &gap) != 0)
+                {
+                    return -1;
+                }
+            id += gap;
+            for (c = 1; c < SF_HISTORY_COLUMNS; c++)
+                {
+                    if (sf_memvarint(&col[c], colend[c], &delta[c - 1]) != 0)
+                        {
+                            return -1;
+                        }
+                    delta[c - 1] = SF_UNZIGZAG(delta[c - 1]);
+                }
+            if (id >= hist->keys.count)
+                {
+                    return -1;
+                }
+            // the previous run is in the columns when the group was in it
+            int carry = !run->keyframe && hist->stamp[id] == idx;
+            hist->keys.bytes[id] = (carry ? hist->keys.bytes[id] : 0) + delta[0];
+            hist->keys.files[id] = (carry ? hist->keys.files[id] : 0) + delta[1];
+            hist->keys.lines[id] = (carry ? hist->keys.lines[id] : 0) + delta[2];
+            hist->keys.min_mtime[id] = (carry ? hist->keys.min_mtime[id] : 0) + delta[3];
+            hist->keys.max_mtime[id] = (carry ? hist->keys.max_mtime[id] : 0) + delta[4];
+            hist->stamp[id] = idx + 1;
+        }
+    hist->decoded = idx;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_history_decode: Bring the dictionary columns to the values of run idx, starting from
+ *   the run decoded last when that is on the way, otherwise from the keyframe before idx.
+ **********************************************************************************************/
+
+static int sf_history_decode(struct sf_history *hist, size_t idx)
+{
+    size_t start = idx;
+    while (start > 0 && !hist->runs[start]->keyframe)
+        {
+            start--;
+        }
+    if (hist->decoded >= (long)start && hist->decoded <= (long)idx)
+        {
+            start = hist->decoded + 1;
+        }
+    for (; start <= idx; start++)
+        {
+            if (sf_history_apply(hist, start) != 0)
+                {
+                    fprintf(stderr, "history run %zu is damaged\n", start);
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+/* Writes the bytes of a memstream column as its length and its content */
+static int sf_history_putcolumn(FILE *out, FILE *column, char **buf, size_t *len)
+{
+    if (fclose(column) != 0)
+        {
+            return -1;
+        }
+    int ret = sf_putvarint(out, *len) != 0 || fwrite(*buf, 1, *len, out) != *len ? -1 : 0;
+    free(*buf);
+    return ret;
+}
+
+static int sf_compare_rows(const void *a, const void *b)
+{
+    uint32_t v1 = *(const uint32_t *)a;
+    uint32_t v2 = *(const uint32_t *)b;
+    return (v1 > v2) - (v1 < v2);
+}
+
+/**********************************************************************************************
+ * sf_history_append: Add the totals of this run to the history file path, creating it if
+ *   needed. Concurrent runs appending to the same file take turns through flock.
+ **********************************************************************************************/
+
+int sf_history_append(sumfiles_t *self, const char *path)
+{
+    struct sf_history hist;
+    sf_groups_t merged;
+    uint32_t *rows = NULL;
+    char *body = NULL;
+    size_t bodylen = 0;
+    int ret = -1;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0)
+        {
+            perror(path);
+            if (fd >= 0)
+                {
+                    close(fd);
+                }
+            return -1;
+        }
+    if (sf_groups_init(&merged) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    if (sf_history_open(&hist, fd, path) != 0 || sf_groups_collect(self, &merged, NULL) != 0)
+        {
+            goto done;
+        }
+
+    size_t idx = hist.nruns;
+    int keyframe = idx % SF_HISTORY_KEYFRAME == 0;
+    if (!keyframe && sf_history_decode(&hist, idx - 1) != 0)
+        {
+            goto done;
+        }
+
+    // give the groups their dictionary ids, new keys are numbered after the known ones
+    uint32_t known = hist.keys.count, id;
+    rows = malloc((merged.count ? merged.count : 1) * sizeof(uint32_t));
+    if (rows == NULL)
+        {
+            goto done;
+        }
+    for (id = 0; id < merged.count; id++)
+        {
+            int32_t key = sf_groups_intern(&hist.keys, merged.key[id], merged.label[id], 1);
+            if (key < 0)
+                {
+                    goto done;
+                }
+            rows[id] = key;
+        }
+    if (sf_history_growstamp(&hist) != 0)
+        {
+            goto done;
+        }
+
+    // the row of key k is the group id of merged with rows[id] == k
+    uint32_t *bykey = malloc((hist.keys.count ? hist.keys.count : 1) * sizeof(uint32_t));
+    if (bykey == NULL)
+        {
+            goto done;
+        }
+    for (id = 0; id < merged.count; id++)
+        {
+            bykey[rows[id]] = id;
+        }
+    qsort(rows, merged.count, sizeof(uint32_t), sf_compare_rows);
+
+    FILE *out = open_memstream(&body, &bodylen);
+    FILE *column[SF_HISTORY_COLUMNS];
+    char *colbuf[SF_HISTORY_COLUMNS];
+    size_t collen[SF_HISTORY_COLUMNS];
+    int c, failed = out == NULL;
+    for (c = 0; c < SF_HISTORY_COLUMNS; c++)
+        {
+            column[c] = open_memstream(&colbuf[c], &collen[c]);
+            failed |= column[c] == NULL;
+        }
+    if (failed)
+        {
+            free(bykey);
+            goto done;
+        }
+
+    failed |= sf_putstring(out, self->rootpath);
+    for (id = known; id < hist.keys.count; id++)
+        {
+            failed |= sf_putstring(out, hist.keys.key[id]) | sf_putstring(out, hist.keys.label[id]);
+        }
+    uint32_t prev = 0, row;
+    for (row = 0; row < merged.count; row++)
+        {
+            uint32_t key = rows[row], gid = bykey[key];
+            int carry = !keyframe && hist.stamp[key] == idx;
+            uint64_t value[SF_HISTORY_COLUMNS - 1] = { merged.bytes[gid], merged.files[gid], merged.lines[gid],
+                                                       merged.min_mtime[gid], merged.max_mtime[gid]
+                                                     };
+            uint64_t before[SF_HISTORY_COLUMNS - 1] = { hist.keys.bytes[key], hist.keys.files[key], hist.keys.lines[key],
+                                                        hist.keys.min_mtime[key], hist.keys.max_mtime[key]
+                                                      };
+            failed |= sf_putvarint(column[0], key - prev);
+            prev = key;
+            for (c = 1; c < SF_HISTORY_COLUMNS; c++)
+                {
+                    uint64_t delta = value[c - 1] - (carry ? before[c - 1] : 0);
+                    failed |= sf_putvarint(column[c], SF_ZIGZAG(delta));
+                }
+        }
+    free(bykey);
+    for (c = 0; c < SF_HISTORY_COLUMNS; c++)
+        {
+            failed |= sf_history_putcolumn(out, column[c], &colbuf[c], &collen[c]);
+        }
+    while (ftell(out) % 8 != 0)
+        {
+            putc(0, out);
+        }
+    if (fclose(out) != 0 || failed)
+        {
+            goto done;
+        }
+
+    struct sf_histrun run;
+    memset(&run, 0, sizeof(run));
+    memcpy(run.magic, "SFHR", 4);
+    run.keyframe = keyframe;
+    run.size = bodylen;
+    run.when = time(NULL);
+    run.modes = sf_dump_modes(self->popts);
+    run.ngroups = merged.count;
+    run.nkeys = hist.keys.count - known;
+
+    char header[8] = SF_HISTORY_MAGIC;
+    *(uint32_t *)(header + 4) = SF_HISTORY_VERSION;
+    // a damaged tail is dropped, the run takes its place
+    off_t end = lseek(fd, hist.end, SEEK_SET);
+    if (end == (off_t)hist.end && ftruncate(fd, hist.end) == 0
+            && (hist.end > 0 || write(fd, header, sizeof(header)) == sizeof(header))
+            && write(fd, &run, sizeof(run)) == sizeof(run)
+            && write(fd, body, bodylen) == (ssize_t)bodylen)
+        {
+            ret = 0;
+        }
+    else
+        {
+            perror(path);
+            // leave the file with its whole runs
+            if (ftruncate(fd, hist.end) != 0)
+                {
+                    perror(path);
+                }
+        }
+
+done:
+    free(body);
+    free(rows);
+    sf_groups_destroy(&merged);
+    sf_history_close(&hist);
+    close(fd);
+    return ret;
+}
+
+static void sf_history_keyname(struct sf_history *hist, uint32_t id, char *buf, size_t size)
+{
+    const char *timekey;
+    size_t extlen = sf_cube_split(hist->keys.key[id], &timekey);
+    if (timekey[0])
+        {
+            // a --cube cell
+            snprintf(buf, size, "%.*s %s", (int)extlen, hist->keys.key[id], timekey);
+        }
+    else
+        {
+            snprintf(buf, size, "%s", hist->keys.key[id][0] ? hist->keys.key[id] : "(none)");
+        }
+}
+
+static char *sf_history_when(int64_t when, char *buf, size_t size)
+{
+    struct tm tm;
+    time_t t = when;
+    localtime_r(&t, &tm);
+    strftime(buf, size, SF_DATETIMEFMT, &tm);
+    return buf;
+}
+
+/* Resolves a run number from the command line, negative ones count from the last run */
+static long sf_history_runidx(struct sf_history *hist, long num)
+{
+    long idx = num < 0 ? (long)hist->nruns + num : num;
+    return idx >= 0 && idx < (long)hist->nruns ? idx : -1;
+}
+
+static uint64_t sf_history_measure(struct sf_history *hist, uint32_t id, int popts)
+{
+    return (popts & SF_LINES) ? hist->keys.lines[id] : hist->keys.bytes[id];
+}
+
+static char *sf_history_amount(char *buf, uint64_t value, int popts)
+{
+    if ((popts & SF_LINES))
+        {
+            sprintf(buf, " %12" PRIu64 "  ", value);
+            return buf;
+        }
+    return show_size(buf, value);
+}
+
+static int sf_compare_delta_desc(const void *a, const void *b, void *arg)
+{
+    const int64_t *delta = arg;
+    int64_t v1 = delta[*(const uint32_t *)a];
+    int64_t v2 = delta[*(const uint32_t *)b];
+    return (v2 > v1) - (v2 < v1);
+}
+
+/* --diff: the groups that grew and shrank the most between two runs, and those that came and went */
+static int sf_history_diff(struct sf_history *hist, long from, long to, int popts, int top)
+{
+    size_t nkeys = hist->keys.count, idx;
+    uint64_t *before = calloc(nkeys ? nkeys : 1, sizeof(uint64_t));
+    int64_t *delta = calloc(nkeys ? nkeys : 1, sizeof(int64_t));
+    uint32_t *order = malloc((nkeys ? nkeys : 1) * sizeof(uint32_t));
+    char name[512], when1[64], when2[64], amount1[32], amount2[32], amount3[32];
+    size_t count = 0;
+    uint32_t id;
+
+    if (before == NULL || delta == NULL || order == NULL || sf_history_decode(hist, from) != 0)
+        {
+            free(before);
+            free(delta);
+            free(order);
+            return -1;
+        }
+    for (id = 0; id < nkeys; id++)
+        {
+            before[id] = hist->stamp[id] == (uint32_t)from + 1 ? sf_history_measure(hist, id, popts) : 0;
+        }
+    if (sf_history_decode(hist, to) != 0)
+        {
+            free(before);
+            free(delta);
+            free(order);
+            return -1;
+        }
+
+    printf("run %ld (%s) -> run %ld (%s)\n", from, sf_history_when(hist->runs[from]->when, when1, sizeof(when1)),
+           to, sf_history_when(hist->runs[to]->when, when2, sizeof(when2)));
+    if (hist->runs[from]->modes != hist->runs[to]->modes)
+        {
+            printf("warning: the runs were summarized with different options\n");
+        }
+    for (id = 0; id < nkeys; id++)
+        {
+            uint64_t after = hist->stamp[id] == (uint32_t)to + 1 ? sf_history_measure(hist, id, popts) : 0;
+            delta[id] = (int64_t)(after - before[id]);
+            if (delta[id] != 0)
+                {
+                    order[count++] = id;
+                }
+        }
+    qsort_r(order, count, sizeof(uint32_t), sf_compare_delta_desc, delta);
+
+    const char *titles[2] = { "grew", "shrank" };
+    int side;
+    for (side = 0; side < 2; side++)
+        {
+            int shown = 0;
+            printf("\n%s:\n", titles[side]);
+            for (idx = 0; idx < count && shown < top; idx++)
+                {
+                    id = order[side == 0 ? idx : count - 1 - idx];
+                    if ((side == 0) != (delta[id] > 0))
+                        {
+                            break;
+                        }
+                    uint64_t after = before[id] + delta[id];
+                    uint64_t change = delta[id] > 0 ? delta[id] : -delta[id];
+                    const char *note = before[id] == 0 ? "  (new)" : after == 0 ? "  (gone)" : "";
+                    sf_history_keyname(hist, id, name, sizeof(name));
+                    printf("  %c%s  %-20s %s -> %s%s\n", delta[id] > 0 ? '+' : '-', sf_history_amount(amount1, change, popts),
+                           name, sf_history_amount(amount2, before[id], popts), sf_history_amount(amount3, after, popts), note);
+                    shown++;
+                }
+        }
+    free(before);
+    free(delta);
+    free(order);
+    return 0;
+}
+
+/* --trend: the largest groups of the last run, followed over the last n runs */
+static int sf_history_trend(struct sf_history *hist, long n, int popts, int top)
+{
+    static const char levels[] = " .:-=+*#";
+    size_t nkeys = hist->keys.count;
+    long first = (long)hist->nruns - n, run, idx;
+    uint64_t *values = calloc((nkeys ? nkeys : 1) * n, sizeof(uint64_t));
+    uint32_t *order = malloc((nkeys ? nkeys : 1) * sizeof(uint32_t));
+    int64_t *last = malloc((nkeys ? nkeys : 1) * sizeof(int64_t));
+    char name[512], amount1[32], amount2[32], when1[64], when2[64];
+    uint32_t id;
+
+    if (values == NULL || order == NULL || last == NULL)
+        {
+            free(values);
+            free(order);
+            free(last);
+            return -1;
+        }
+    for (run = first; run < (long)hist->nruns; run++)
+        {
+            if (sf_history_decode(hist, run) != 0)
+                {
+                    free(values);
+                    free(order);
+                    free(last);
+                    return -1;
+                }
+            for (id = 0; id < nkeys; id++)
+                {
+                    if (hist->stamp[id] == (uint32_t)run + 1)
+                        {
+                            values[id * n + run - first] = sf_history_measure(hist, id, popts);
+                        }
+                }
+        }
+    for (id = 0; id < nkeys; id++)
+        {
+            order[id] = id;
+            last[id] = values[id * n + n - 1];
+        }
+    qsort_r(order, nkeys, sizeof(uint32_t), sf_compare_delta_desc, last);
+
+    printf("last %ld runs, %s to %s\n\n", n, sf_history_when(hist->runs[first]->when, when1, sizeof(when1)),
+           sf_history_when(hist->runs[hist->nruns - 1]->when, when2, sizeof(when2)));
+    for (idx = 0; idx < (long)nkeys && idx < top; idx++)
+        {
+            const uint64_t *row = &values[order[idx] * n];
+            uint64_t lo = row[0], hi = row[0];
+            char spark[n + 1];
+            for (run = 0; run < n; run++)
+                {
+                    lo = row[run] < lo ? row[run] : lo;
+                    hi = row[run] > hi ? row[run] : hi;
+                }
+            for (run = 0; run < n; run++)
+                {
+                    spark[run] = levels[hi > lo ? 1 + (row[run] - lo) * (sizeof(levels) - 3) / (hi - lo) : 1];
+                }
+            spark[n] = 0;
+            sf_history_keyname(hist, order[idx], name, sizeof(name));
+            printf("  %-20s %s -> %s  [%s]\n", name, sf_history_amount(amount1, row[0], popts),
+                   sf_history_amount(amount2, row[n - 1], popts), spark);
+        }
+    free(values);
+    free(order);
+    free(last);
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_history_show: The history subcommand. Lists the runs of the file, then either compares
+ *   two runs (diff "A:B", run numbers from 0, negative ones from the end) or follows the
+ *   largest groups over the last trend runs. Without either the last two runs are compared.
+ **********************************************************************************************/
+
+int sf_history_show(const char *path, const char *diff, int trend, int popts, int top)
+{
+    struct sf_history hist;
+    char when[64];
+    int ret = -1;
+    size_t idx;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        {
+            perror(path);
+            return -1;
+        }
+    if (sf_history_open(&hist, fd, path) != 0)
+        {
+            sf_history_close(&hist);
+            close(fd);
+            return -1;
+        }
+    close(fd);
+
+    if (diff == NULL && trend == 0)
+        {
+            for (idx = 0; idx < hist.nruns; idx++)
+                {
+                    const unsigned char *pos = (const unsigned char *)(hist.runs[idx] + 1);
+                    char root[1024];
+                    if (sf_memstring(&pos, pos + hist.runs[idx]->size, root, sizeof(root)) != 0)
+                        {
+                            strcpy(root, "?");
+                        }
+                    printf("%4zu  %s  %6u groups  %s\n", idx, sf_history_when(hist.runs[idx]->when, when, sizeof(when)),
+                           hist.runs[idx]->ngroups, root);
+                }
+            printf("\n");
+        }
+
+    long from, to;
+    if (trend > 0 && hist.nruns == 0)
+        {
+            // nothing to follow yet
+            printf("%s has no runs yet\n", path);
+            ret = 0;
+        }
+    else if (trend > 0)
+        {
+            ret = sf_history_trend(&hist, trend < (int)hist.nruns ? trend : (long)hist.nruns, popts, top);
+        }
+    else if (diff != NULL && sscanf(diff, "%ld:%ld", &from, &to) != 2)
+        {
+            fprintf(stderr, "--diff expects two run numbers A:B\n");
+        }
+    else if (diff == NULL && hist.nruns < 2)
+        {
+            // nothing to compare yet
+            ret = 0;
+        }
+    else
+        {
+            if (diff == NULL)
+                {
+                    from = -2;
+                    to = -1;
+                }
+            from = sf_history_runidx(&hist, from);
+            to = sf_history_runidx(&hist, to);
+            if (from < 0 || to < 0)
+                {
+                    fprintf(stderr, "%s has %zu runs, numbered from 0\n", path, hist.nruns);
+                }
+            else
+                {
+                    ret = sf_history_diff(&hist, from, to, popts, top);
+                }
+        }
+    sf_history_close(&hist);
+    return ret;
+}
@@ -0,0 +1,138 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#ifndef LIBSUMMARIZEFILES_H
+#define LIBSUMMARIZEFILES_H
+
+/**
+ * libsummarizefiles: the scan engine of sf.exe, for running scans in process.
+ *
+ *   struct sf_config config;
+ *   sf_config_init(&config);
+ *   config.popts = SF_EXT;
+ *   config.on_result = my_groups;
+ *   sumfiles_t *scan = sf_open(&config);
+ *   sf_scan(scan, "/srv");
+ *   sf_finish(scan);
+ *   sf_close(scan);
+ *
+ * A scan keeps all of its state in its sumfiles_t, so any number of them can run at once on
+ * different threads. With callbacks set nothing is drawn or printed. Several scans can share
+ * one pool of content workers, see sf_pool_new (0 workers to have their number tuned).
+ *
+ * Instead of scanning, a sumfiles_t can be filled from the --dump files of a sharded scan
+ * (sf_dump_merge) or from a recording (sf_replay). Between the scan and sf_finish, sf_watch
+ * follows the changes with SF_WATCH, and the totals can be saved with sf_dump_write and
+ * sf_history_append.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* popts: what to summarize by and how */
+#define SF_LOG    1
+#define SF_EXT    2
+#define SF_TIME   4
+#define SF_DEBUG  8
+#define SF_LINES 16
+#define SF_WATCH 32
+#define SF_ESTIMATE 64
+#define SF_HIST 128
+#define SF_JSON 256
+#define SF_CUBE 512
+#define SF_DECOMPRESS 1024
+#define SF_STATS 2048
+#define SF_REPLAY 4096
+#define SF_OWNER 8192
+#define SF_OWNEREXT 16384
+#define SF_MIME 32768
+#define SF_DUPES 65536
+
+typedef struct sumfiles sumfiles_t;
+typedef struct sf_pool sf_pool_t;
+
+/* A file as it was counted */
+struct sf_fileinfo
+{
+    const char *path;
+    const char *key;         // the group it went to
+    const char *label;
+    uint64_t bytes;
+    uint64_t lines;
+    time_t mtime;
+};
+
+/* The totals of a group */
+struct sf_group
+{
+    const char *key;
+    const char *label;
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t lines;
+    time_t min_mtime;
+    time_t max_mtime;
+    uint64_t dupbytes;       // SF_DUPES: bytes in copies of other files, reclaimable
+    uint64_t dupfiles;       //   and the number of those copies
+};
+
+/* Called for every file counted, from the scanning threads and the content workers at once */
+typedef void (*sf_file_cb)(void *cbdata, const struct sf_fileinfo *file);
+/* Called with the groups in view order, largest first; they are only valid during the call */
+typedef void (*sf_groups_cb)(void *cbdata, const struct sf_group *groups, size_t count);
+
+struct sf_config
+{
+    int popts;               // SF_EXT, SF_TIME, SF_LINES, ... by extension when none is given
+    int workers;             // content workers for SF_LINES and SF_MIME, when no pool is given,
+                             //   and the threads hashing for SF_DUPES; 0 to tune them while
+                             //   the scan runs
+    sf_pool_t *pool;         // content workers shared with other scans, see sf_pool_new
+    int top;                 // largest and newest files kept per group
+    const char *where;       // SF_CUBE: the value of the other dimension to roll up
+    int shard;               // scan the shard-th (from 1) of shards, 0 for all of it
+    int shards;
+    const char *checkpoint;  // save the progress to this file
+    int checkpoint_interval; // seconds
+    int resume;              // continue the scan saved in checkpoint
+    const char *record;      // write every file counted here, for --replay
+    double max_iops;         // throttles, 0 for none
+    double max_bandwidth;    // bytes per second
+    double max_latency;      // ms
+    int idle;                // move the process to the idle I/O scheduling class
+
+    sf_file_cb on_file;
+    sf_groups_cb on_progress; // about every 300 ms while sf_scan runs; with SF_ESTIMATE sampled
+                              //   totals until the root is scanned
+    sf_groups_cb on_result;   // once, from sf_finish
+    void *cbdata;
+};
+
+void sf_config_init(struct sf_config *config);
+sumfiles_t *sf_open(const struct sf_config *config);
+int sf_scan(sumfiles_t *self, const char *root);
+int sf_dump_merge(sumfiles_t *self, const char *path);
+int sf_replay(sumfiles_t *self, const char *path);
+int sf_watch(sumfiles_t *self);
+void sf_interrupt(sumfiles_t *self);
+int sf_dump_write(sumfiles_t *self, const char *path);
+int sf_history_append(sumfiles_t *self, const char *path);
+int sf_finish(sumfiles_t *self);
+void sf_close(sumfiles_t *self);
+
+int sf_history_show(const char *path, const char *diff, int trend, int popts, int top);
+
+sf_pool_t *sf_pool_new(int nworkers);
+void sf_pool_destroy(sf_pool_t *pool);
+
+#endif
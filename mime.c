@@ -0,0 +1,222 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "summarizefiles.h"
+
+/**
+ * --by-mime: group files by the MIME type and encoding libmagic finds in their content, as in
+ * "text/x-c; charset=us-ascii". Detection reads the head of every file, so the traversal hands
+ * the files to the content workers (pool.c). A magic_t can not be shared between threads,
+ * every worker loads a handle of its own once and keeps it. --lines asks the same question
+ * to tell text from binary and goes through here as well.
+ *
+ * Verdicts are cached for the process by (dev, ino, size, mtime), so hard links, files seen
+ * again by --watch and files of another scan in the same process are not read twice. The
+ * cache is a fixed table of SF_MIME_CACHE verdicts with one lock per stripe of slots; a new
+ * verdict replaces whatever held its slot. The MIME strings are interned once, the cache and
+ * the group keys all point at the same copy.
+ */
+
+#define SF_MIME_CACHE   (1 << 16)
+#define SF_MIME_STRIPES 64
+/* what libmagic says of an empty file, without opening it */
+#define SF_MIME_EMPTY   "inode/x-empty; charset=binary"
+
+struct sf_mimeverdict
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    const char *mime;        // NULL while the slot is free
+};
+
+static pthread_once_t sf_mime_once = PTHREAD_ONCE_INIT;
+static struct sf_mimeverdict *sf_mime_cache = NULL;
+static pthread_mutex_t sf_mime_locks[SF_MIME_STRIPES];
+static pthread_mutex_t sf_mime_typelock = PTHREAD_MUTEX_INITIALIZER;
+static sf_groups_t sf_mime_types;
+static int sf_mime_typesready = 0;
+
+static void sf_mime_init(void)
+{
+    int stripe;
+    for (stripe = 0; stripe < SF_MIME_STRIPES; stripe++)
+        {
+            pthread_mutex_init(&sf_mime_locks[stripe], NULL);
+        }
+    // lives as long as the process; without it every file is simply detected
+    sf_mime_cache = calloc(SF_MIME_CACHE, sizeof(struct sf_mimeverdict));
+}
+
+/* The one copy of a MIME string, NULL when it can not be kept */
+static const char *sf_mime_intern(const char *mime)
+{
+    const char *interned = NULL;
+    pthread_mutex_lock(&sf_mime_typelock);
+    if (!sf_mime_typesready && sf_groups_init(&sf_mime_types) == 0)
+        {
+            sf_mime_typesready = 1;
+        }
+    if (sf_mime_typesready)
+        {
+            int32_t id = sf_groups_intern(&sf_mime_types, mime, "", 1);
+            interned = id >= 0 ? sf_mime_types.key[id] : NULL;
+        }
+    pthread_mutex_unlock(&sf_mime_typelock);
+    return interned;
+}
+
+static size_t sf_mime_slot(const struct stat *info)
+{
+    uint64_t hash = ((uint64_t)info->st_dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)info->st_ino;
+    hash *= 0xff51afd7ed558ccdULL;
+    return (hash >> 40) & (SF_MIME_CACHE - 1);
+}
+
+/**********************************************************************************************
+ * sf_mime_detect: The MIME type and encoding of a file, from the cache or from libmagic. fd is
+ *   the open file, or -1 to have fullpath opened only when the verdict is not cached. magic is
+ *   the calling thread's libmagic handle, loaded on demand. NULL when the file can not be read
+ *   or libmagic is not available.
+ **********************************************************************************************/
+
+const char *sf_mime_detect(sumfiles_t *self, magic_t *magic, const char *fullpath, int fd,
+                           const struct stat *info)
+{
+    const char *mime = NULL;
+
+    pthread_once(&sf_mime_once, sf_mime_init);
+    size_t slot = sf_mime_slot(info);
+    pthread_mutex_t *lock = &sf_mime_locks[slot % SF_MIME_STRIPES];
+    if (sf_mime_cache != NULL)
+        {
+            struct sf_mimeverdict *verdict = &sf_mime_cache[slot];
+            pthread_mutex_lock(lock);
+            if (verdict->mime != NULL && verdict->ino == info->st_ino && verdict->dev == info->st_dev
+                    && verdict->size == info->st_size && verdict->mtime.tv_sec == info->st_mtim.tv_sec
+                    && verdict->mtime.tv_nsec == info->st_mtim.tv_nsec)
+                {
+                    mime = verdict->mime;
+                }
+            pthread_mutex_unlock(lock);
+            if (mime != NULL)
+                {
+                    __sync_fetch_and_add(&self->mime_cached, 1);
+                    return mime;
+                }
+        }
+
+    int ownfd = fd < 0;
+    if (ownfd)
+        {
+            fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                {
+                    return NULL;
+                }
+        }
+    // the throttle counts the check as one read of a chunk, or of the file when smaller
+    magic_t session = sf_loadmagic(self, magic);
+    if (session == NULL)
+        {
+            if (ownfd)
+                {
+                    close(fd);
+                }
+            return NULL;
+        }
+    uint64_t head = info->st_size < SF_CONTENT_CHUNK ? (uint64_t)info->st_size : SF_CONTENT_CHUNK;
+    uint64_t begin = sf_throttle_begin(self->throttle, head);
+    const char *ftype = magic_descriptor(session, fd);
+    sf_throttle_end(self->throttle, begin, 0);
+    if (ftype != NULL)
+        {
+            mime = sf_mime_intern(ftype);
+        }
+    if (ownfd)
+        {
+            close(fd);
+        }
+    if (mime == NULL)
+        {
+            return NULL;
+        }
+    __sync_fetch_and_add(&self->mime_detected, 1);
+
+    if (sf_mime_cache != NULL)
+        {
+            struct sf_mimeverdict *verdict = &sf_mime_cache[slot];
+            pthread_mutex_lock(lock);
+            verdict->dev = info->st_dev;
+            verdict->ino = info->st_ino;
+            verdict->size = info->st_size;
+            verdict->mtime = info->st_mtim;
+            verdict->mime = mime;
+            pthread_mutex_unlock(lock);
+        }
+    return mime;
+}
+
+/**********************************************************************************************
+ * sf_addentry_bymime: Fill rec with the MIME group of a file. With --lines the lines of text
+ *   files are counted too, the check for text finds the verdict in the cache.
+ **********************************************************************************************/
+
+int sf_addentry_bymime(sumfiles_t *self, magic_t *magic, const char *fullpath, const struct stat *info,
+                       sf_filerec_t *rec)
+{
+    const char *mime = SF_MIME_EMPTY;
+    uint64_t lines = 0;
+
+    if (info->st_size > 0)
+        {
+            mime = sf_mime_detect(self, magic, fullpath, -1, info);
+            if (mime == NULL)
+                {
+                    // counted without a type
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    mime = "";
+                }
+            else if ((self->popts & (SF_LINES | SF_REPLAY)) == SF_LINES
+                     && sf_content_lines(self, magic, fullpath, &lines) != 0)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                }
+        }
+
+    rec->key = mime;
+    rec->ext = -1;
+    rec->label = "";
+    rec->bytes = info->st_size;
+    rec->lines = lines;
+    rec->mtime = info->st_mtime;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_mime_split: The MIME type of a key into buf, and its encoding, "" when there is none.
+ **********************************************************************************************/
+
+const char *sf_mime_split(const char *key, char *buf, size_t size, const char **charset)
+{
+    const char *sep = strstr(key, "; charset=");
+    size_t len = sep != NULL ? (size_t)(sep - key) : strlen(key);
+    snprintf(buf, size, "%.*s", (int)len, key);
+    *charset = sep != NULL ? sep + strlen("; charset=") : "";
+    return buf;
+}
@@ -0,0 +1,310 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "summarizefiles.h"
+
+/**
+ * mkexttab: build time generator of exttab.h, the perfect hash table of the extensions listed
+ * in exttab.txt (see ext.c).
+ *
+ *   mkexttab exttab.txt > exttab.h
+ *
+ * Hash and displace: an extension's FNV-1a hash picks a bucket, and every bucket gets the
+ * first displacement that moves all of its extensions into free slots with SF_EXTTAB_SLOT.
+ * The largest buckets are placed first, while most slots are still free. A lookup is then the
+ * hash, two array reads and a 16 byte compare to reject extensions that are not in the table.
+ * Id 0 is the empty extension, it is never hashed. sf_exttab_tails marks the extensions that
+ * end a compound one, only those make ext.c look at the part before them.
+ */
+
+#define SF_MKEXT_MAXDISPLACE 65535
+
+struct sf_mkext
+{
+    char name[SF_EXT_MAXLEN + 1];
+    uint64_t hash;
+    uint16_t tail;           // some compound extension ends in this one
+};
+
+static struct sf_mkext *sf_mkext_names = NULL;
+static size_t sf_mkext_count = 0;
+
+static uint64_t sf_mkext_hash(const char *name)
+{
+    uint64_t hash = SF_FNV_BASIS;
+    while (*name)
+        {
+            hash = SF_FNV_STEP(hash, *name++);
+        }
+    return hash;
+}
+
+static int sf_mkext_read(const char *path)
+{
+    char line[256];
+    size_t size = 512;
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+        {
+            perror(path);
+            return -1;
+        }
+    sf_mkext_names = calloc(size, sizeof(struct sf_mkext));
+    if (sf_mkext_names == NULL)
+        {
+            fclose(in);
+            return -1;
+        }
+    sf_mkext_count = 1;    // ""
+
+    int lineno = 0;
+    while (fgets(line, sizeof(line), in) != NULL)
+        {
+            size_t len = strcspn(line, "\r\n"), idx;
+            const char *dot;
+            line[len] = 0;
+            lineno++;
+            if (len == 0 || line[0] == '#')
+                {
+                    continue;
+                }
+            dot = strchr(line, '.');
+            if (len > SF_EXT_MAXLEN || strspn(line, "abcdefghijklmnopqrstuvwxyz0123456789_-+.") != len
+                    || line[0] == '.' || line[len - 1] == '.' || (dot != NULL && strchr(dot + 1, '.') != NULL))
+                {
+                    fprintf(stderr, "%s:%d: %s: extensions are lower case, at most %d long, with one part or two\n",
+                            path, lineno, line, SF_EXT_MAXLEN);
+                    fclose(in);
+                    return -1;
+                }
+            for (idx = 1; idx < sf_mkext_count; idx++)
+                {
+                    if (strcmp(sf_mkext_names[idx].name, line) == 0)
+                        {
+                            fprintf(stderr, "%s:%d: %s is listed twice\n", path, lineno, line);
+                            fclose(in);
+                            return -1;
+                        }
+                }
+            if (sf_mkext_count == size)
+                {
+                    struct sf_mkext *names = realloc(sf_mkext_names, size * 2 * sizeof(struct sf_mkext));
+                    if (names == NULL)
+                        {
+                            fclose(in);
+                            return -1;
+                        }
+                    sf_mkext_names = names;
+                    size *= 2;
+                }
+            strcpy(sf_mkext_names[sf_mkext_count].name, line);
+            sf_mkext_names[sf_mkext_count].hash = sf_mkext_hash(line);
+            sf_mkext_count++;
+        }
+    fclose(in);
+
+    // a compound extension is only found through its last part
+    size_t id;
+    for (id = 1; id < sf_mkext_count; id++)
+        {
+            const char *dot = strchr(sf_mkext_names[id].name, '.');
+            size_t other;
+            if (dot == NULL)
+                {
+                    continue;
+                }
+            const char *tail = dot + 1;
+            for (other = 1; other < sf_mkext_count && strcmp(sf_mkext_names[other].name, tail) != 0; other++)
+                ;
+            if (other == sf_mkext_count)
+                {
+                    fprintf(stderr, "%s: %s needs %s listed on its own\n", path, sf_mkext_names[id].name, tail);
+                    return -1;
+                }
+            sf_mkext_names[other].tail = 1;
+        }
+    return 0;
+}
+
+/* The buckets from the largest down, by their number of extensions */
+static size_t *sf_mkext_bucketsize = NULL;
+
+static int sf_mkext_compare_bucket(const void *a, const void *b)
+{
+    size_t v1 = sf_mkext_bucketsize[*(const uint32_t *)a];
+    size_t v2 = sf_mkext_bucketsize[*(const uint32_t *)b];
+    return (v2 > v1) - (v2 < v1);
+}
+
+/* Place every extension, returns -1 when some bucket finds no displacement */
+static int sf_mkext_place(size_t buckets, size_t slots, uint16_t *displace, uint16_t *slot)
+{
+    uint32_t *order = malloc(buckets * sizeof(uint32_t));
+    uint32_t *members = malloc(sf_mkext_count * sizeof(uint32_t));
+    size_t *taken = malloc(sf_mkext_count * sizeof(size_t));
+    size_t bucket, id;
+    int ret = 0;
+
+    sf_mkext_bucketsize = calloc(buckets, sizeof(size_t));
+    if (order == NULL || members == NULL || taken == NULL || sf_mkext_bucketsize == NULL)
+        {
+            fprintf(stderr, "mkexttab: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    memset(slot, 0, slots * sizeof(uint16_t));
+    for (id = 1; id < sf_mkext_count; id++)
+        {
+            sf_mkext_bucketsize[sf_mkext_names[id].hash & (buckets - 1)]++;
+        }
+    for (bucket = 0; bucket < buckets; bucket++)
+        {
+            order[bucket] = bucket;
+        }
+    qsort(order, buckets, sizeof(uint32_t), sf_mkext_compare_bucket);
+
+    for (bucket = 0; bucket < buckets && ret == 0; bucket++)
+        {
+            size_t nmembers = 0, member;
+            uint32_t d;
+            for (id = 1; id < sf_mkext_count; id++)
+                {
+                    if ((sf_mkext_names[id].hash & (buckets - 1)) == order[bucket])
+                        {
+                            members[nmembers++] = id;
+                        }
+                }
+            for (d = 0; d <= SF_MKEXT_MAXDISPLACE; d++)
+                {
+                    for (member = 0; member < nmembers; member++)
+                        {
+                            size_t at = SF_EXTTAB_SLOT(sf_mkext_names[members[member]].hash, d, slots - 1), prev;
+                            for (prev = 0; prev < member && taken[prev] != at; prev++)
+                                ;
+                            if (slot[at] != 0 || prev < member)
+                                {
+                                    break;
+                                }
+                            taken[member] = at;
+                        }
+                    if (member == nmembers)
+                        {
+                            break;
+                        }
+                }
+            if (d > SF_MKEXT_MAXDISPLACE)
+                {
+                    ret = -1;
+                    break;
+                }
+            displace[order[bucket]] = d;
+            for (member = 0; member < nmembers; member++)
+                {
+                    slot[taken[member]] = members[member] + 1;
+                }
+        }
+
+    free(sf_mkext_bucketsize);
+    free(taken);
+    free(members);
+    free(order);
+    return ret;
+}
+
+static void sf_mkext_column(const char *decl, const uint16_t *values, size_t count)
+{
+    size_t idx;
+    printf("%s =\n{", decl);
+    for (idx = 0; idx < count; idx++)
+        {
+            printf("%s%u%s", idx % 16 ? " " : "\n    ", values[idx], idx + 1 < count ? "," : "");
+        }
+    printf("\n};\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t buckets = 1, slots = 1, id;
+
+    if (argc != 2)
+        {
+            fprintf(stderr, "usage: mkexttab exttab.txt > exttab.h\n");
+            return EXIT_FAILURE;
+        }
+    if (sf_mkext_read(argv[1]) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+    // about 3 extensions per bucket and a quarter of the slots left free
+    while (buckets * 3 < sf_mkext_count)
+        {
+            buckets *= 2;
+        }
+    while (slots * 3 < sf_mkext_count * 4)
+        {
+            slots *= 2;
+        }
+
+    uint16_t *displace = malloc(buckets * sizeof(uint16_t));
+    uint16_t *slot = malloc(slots * 2 * sizeof(uint16_t));
+    if (displace == NULL || slot == NULL)
+        {
+            fprintf(stderr, "mkexttab: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    if (sf_mkext_place(buckets, slots, displace, slot) != 0)
+        {
+            // too crowded for this list, spread it over twice the slots
+            slots *= 2;
+            if (sf_mkext_place(buckets, slots, displace, slot) != 0)
+                {
+                    fprintf(stderr, "mkexttab: no perfect hash found for %s\n", argv[1]);
+                    return EXIT_FAILURE;
+                }
+        }
+
+    printf("/* Generated from %s by mkexttab, do not edit */\n\n", argv[1]);
+    printf("#define SF_EXTTAB_COUNT %zu\n", sf_mkext_count);
+    printf("#define SF_EXTTAB_BUCKETS %zu\n", buckets);
+    printf("#define SF_EXTTAB_SLOTS %zu\n\n", slots);
+    printf("/* padded with zeros, ext.c compares them as a whole */\n");
+    printf("static const char sf_exttab_names[SF_EXTTAB_COUNT][SF_EXT_MAXLEN + 1] =\n{");
+    for (id = 0; id < sf_mkext_count; id++)
+        {
+            printf("%s\"%s\"%s", id % 8 ? " " : "\n    ", sf_mkext_names[id].name, id + 1 < sf_mkext_count ? "," : "");
+        }
+    printf("\n};\n\n");
+    uint16_t *tails = calloc(sf_mkext_count, sizeof(uint16_t));
+    if (tails == NULL)
+        {
+            fprintf(stderr, "mkexttab: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    for (id = 0; id < sf_mkext_count; id++)
+        {
+            tails[id] = sf_mkext_names[id].tail;
+        }
+    printf("/* 1 for the extensions that end a compound one */\n");
+    sf_mkext_column("static const uint8_t sf_exttab_tails[SF_EXTTAB_COUNT]", tails, sf_mkext_count);
+    sf_mkext_column("static const uint16_t sf_exttab_displace[SF_EXTTAB_BUCKETS]", displace, buckets);
+    printf("/* extension id + 1, 0 when the slot is free */\n");
+    sf_mkext_column("static const uint16_t sf_exttab_slots[SF_EXTTAB_SLOTS]", slot, slots);
+
+    free(tails);
+    free(slot);
+    free(displace);
+    free(sf_mkext_names);
+    return EXIT_SUCCESS;
+}
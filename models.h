@@ -1,50 +1,206 @@
 #include <time.h>
 #include <limits.h>
-#include <cfuhash.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <magic.h>
 
-#define SF_LOG    1
-#define SF_EXT    2
-#define SF_TIME   4
-#define SF_DEBUG  8
-#define SF_LINES 16
+// the popts flags and the public API
+#include "libsummarizefiles.h"
+
+/* joins the extension and the time bucket of a --cube cell key */
+#define SF_CUBE_SEP '\x1f'
+
+#define SF_ARENA_CHUNK    (64 * 1024)
+#define SF_ARENA_MAXCHUNK (16 * 1024 * 1024)
+
+struct sf_arena_chunk
+{
+    struct sf_arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(16)));
+};
+
+struct sf_arena
+{
+    struct sf_arena_chunk *head;
+    size_t allocated;
+};
+typedef struct sf_arena sf_arena_t;
+
+/* log2 file size histogram: bucket 0 holds sizes 0 and 1, bucket k sizes [2^k, 2^(k+1)) */
+#define SF_HIST_BUCKETS 64
+#define SF_HIST_BUCKET(bytes) (63 - __builtin_clzll((uint64_t)(bytes) | 1))
+
+#define SF_GROUPS_HIST 1
+#define SF_GROUPS_TOP  2
+#define SF_GROUPS_DUPES 4
+
+/* --top: per group the N largest and the N most recently modified files, as min-heaps */
+#define SF_TOP_LARGEST 0
+#define SF_TOP_NEWEST  1
+#define SF_TOP_LISTS   2
+
+struct sf_topfile
+{
+    int64_t value;           // size or mtime
+    const char *path;
+};
+
+/* --by-owner: a group by its numeric key, see sf_groups_internowner */
+struct sf_ownerslot
+{
+    uint64_t owner;          // uid << 32 | gid
+    int32_t ext;             // extension id with --by-owner=ext, -1 without
+    uint32_t id;             // group id + 1, 0 when the slot is free
+};
+
+/* One table per scanning thread, chained off sumfiles.groups. Groups are interned into ids
+ * and every statistic is a column indexed by the id. */
+struct sf_groups
+{
+    sf_arena_t arena;
+    uint32_t *slots;         // group id + 1, 0 when the slot is free
+    size_t capacity;
+    size_t count;
+    size_t size;             // allocated length of the columns
+
+    const char **key;
+    const char **label;
+    unsigned long *hash;
+    uint64_t *bytes;
+    uint64_t *files;
+    uint64_t *lines;
+    time_t *min_mtime;
+    time_t *max_mtime;
+    uint64_t *hist;          // SF_HIST_BUCKETS per group with SF_GROUPS_HIST, otherwise NULL
+    struct sf_topfile *top;  // SF_TOP_LISTS heaps of topn files per group when topn is set
+    uint32_t *ntop;          // entries used in each of those heaps
+    uint64_t *dupbytes;      // with SF_GROUPS_DUPES the bytes and the number of files that are
+    uint64_t *dupfiles;      //   copies of another file, see dupes.c
+    uint32_t *byext;         // extension id -> group id + 1, see sf_groups_internext
+    size_t byextsize;
+    struct sf_ownerslot *byowner; // open addressing, see sf_groups_internowner
+    size_t byownersize;      // a power of two
+    size_t byownercount;
+    int flags;
+    int topn;
+
+    pthread_mutex_t lock;
+    pthread_t thread;        // the thread counting into the table
+    const char *counting;    // the pool job being counted into the table, see sf_pool_collect
+    struct sf_groups *chain;
+};
+typedef struct sf_groups sf_groups_t;
+
+typedef struct sf_watch sf_watch_t;
+typedef struct sf_estimate sf_estimate_t;
+typedef struct sf_record sf_record_t;
+typedef struct sf_throttle sf_throttle_t;
+typedef struct sf_owners sf_owners_t;
+typedef struct sf_dupes sf_dupes_t;
+typedef struct sf_tune sf_tune_t;
+
+/* How the content of a --lines file was read, see content.c */
+#define SF_CODEC_PLAIN 0
+#define SF_CODEC_GZIP  1
+#define SF_CODEC_XZ    2
+#define SF_CODEC_ZSTD  3
+#define SF_CODECS      4
+
+struct sf_codecstats
+{
+    uint64_t files;
+    uint64_t inbytes;        // read from disk
+    uint64_t outbytes;       // after decompression
+    uint64_t nanos;          // spent reading and counting, summed over the threads
+};
 
 struct sumfiles
 {
-    char rootpath[1024];
-    char rootpathdisp[256];
-    short popts;
+    char rootpath[PATH_MAX];
+    char rootpathdisp[PATH_MAX + 2]; // rootpath, or its end after ".."
+    int popts;
     int console_cols;
     int console_rows;
     int dentries;
     int entries_per_line;
     int colsize;
-    int exceptions;
+    uint64_t exceptions;     // bumped by the scanning threads and content workers at once
 
     time_t min_mod_time;
     time_t max_mod_time;
     time_t last_refresh;
 
-    cfuhash_table_t *entries;
+    unsigned long scan_id;
+    pthread_mutex_t lock;
+    sf_groups_t *groups;     // per thread tables
+    sf_groups_t snapshot;    // merged view of the tables, rebuilt by sf_show
+    sf_groups_t rollup;      // --cube: the cells of the snapshot folded to the dimension viewed
+    const char *where;       // --cube: only roll up cells with this value for the other dimension
+    uint32_t *order;         // permutation of the snapshot ids handed to the view
+    size_t order_size;
+    sf_groups_t *shown;      // what the last sf_show drew, the first nshown ids of order
+    size_t nshown;
+
     magic_t magic_session;
-};
-typedef struct sumfiles sumfiles_t;
+    sf_pool_t *pool;         // content workers for --lines, see pool.c
+    sf_tune_t *stattune;     // stats the entries of a directory concurrently, see tune.c
+    struct sf_codecstats codecstats[SF_CODECS];
+    sf_record_t *record;     // --record, see record.c
+    sf_throttle_t *throttle; // --max-iops, --max-bandwidth, --max-latency, see throttle.c
+    sf_owners_t *owners;     // --by-owner: user and group names looked up so far, see owner.c
+    uint64_t mime_detected;  // files libmagic looked at, see mime.c
+    uint64_t mime_cached;    //   and files whose verdict was cached
+    sf_dupes_t *dupes;       // --dupes: the files to compare once the scan is done, see dupes.c
+    uint64_t replayed;       // --replay: files fed back so far
+    uint64_t replay_nanos;
+    sf_watch_t *watch;       // set in --watch mode, see watch.c
+    sf_estimate_t *estimate; // sampling thread while an --estimate scan runs, see estimate.c
+    uint64_t probes;         // walks behind the snapshot, 0 when it holds exact totals
+    double *ci;              // relative 95% confidence half width per snapshot id
+    size_t cisize;
+
+    const char *checkpoint;  // --checkpoint file, see checkpoint.c
+    int checkpoint_interval;
+    time_t last_checkpoint;
+    int rootidx;             // index of the root being scanned
+    int resume_root;         // --resume: first root not finished, and where to pick it up
+    char resume_cursor[1024];
+    char **resume_files;     //   and the files the workers had not counted yet at that point
+    size_t nresume;
 
-#define SF_STRING_LIMIT 50
+    int shard;               // --shard i/N: scan only the top level entries that hash to shard i
+    int shards;              //   of shards, 0 when the scan is not sharded
 
-struct sumentry
+    struct sf_config config; // what sf_open was given, the callbacks in particular
+    int ownpool;             // pool was made for this scan, not shared
+    uint64_t pending;        // files handed to the pool and not counted yet, under its lock
+    int rootcount;           // roots passed to sf_scan so far
+    int finished;            // sf_finish is drawing the final results
+    int merged;              // --dump files added by sf_dump_merge
+    int nomagic;             // the libmagic database could not be loaded, see sf_loadmagic
+    struct sf_group *results; // handed to on_progress / on_result
+    size_t results_size;
+};
+
+/* What a single file contributes to its group */
+struct sf_filerec
 {
-    char group[SF_STRING_LIMIT];
-    char label[SF_STRING_LIMIT];
-    long total_bytes;
-    int line_count;
-    int file_count;
-    time_t min_mod_time;
-    time_t max_mod_time;
-    char *display;
+    const char *key;         // NULL for an owner key that is only built for a new group
+    int32_t ext;             // extension id when the key is the bare extension or, with a NULL
+                             //   key, the extension of the owner key, otherwise -1
+    const char *label;
+    uint64_t owner;          // --by-owner: uid << 32 | gid
+    const char *ownerext;    // --by-owner=ext: the extension, otherwise NULL
+    uint64_t bytes;
+    uint64_t lines;
+    time_t mtime;
+    char keybuf[NAME_MAX + 32];
+    char labelbuf[16];
 };
-typedef struct sumentry sumentry_t;
+typedef struct sf_filerec sf_filerec_t;
 
 #define SF_DATEFMT "%Y-%m-%d"
-#define SF_DATETIMEFMT "%Y-%m-%d %H:%m"
+#define SF_DATETIMEFMT "%Y-%m-%d %H:%M"
 
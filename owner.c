@@ -0,0 +1,241 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include "summarizefiles.h"
+
+/**
+ * --by-owner: group files by the user and group owning them, and with --by-owner=ext by their
+ * extension as well. The scan only ever sees the numeric ids, a key is "uid:gid" or
+ * "uid:gid/ext" ('/' can not be part of a file name). A file is looked up in its group table
+ * by the ids and its extension id (sf_groups_internowner), the key is built and hashed only
+ * for the first file of a group. Names are looked up when a group is drawn, once per
+ * distinct id, and kept in a sorted table for the rest of the run, so a slow NSS source
+ * (LDAP, NIS) costs a lookup per owner instead of one per file.
+ */
+
+#define SF_OWNER_GROUPBIT ((uint64_t)1 << 32)
+
+struct sf_idname
+{
+    uint64_t id;             // uid, or gid | SF_OWNER_GROUPBIT
+    const char *name;
+};
+
+struct sf_owners
+{
+    struct sf_idname *names; // sorted by id
+    size_t count;
+    size_t size;
+    sf_arena_t arena;
+};
+
+/**********************************************************************************************
+ * sf_owner_fillrec: Make rec the record of a file owned by info's uid and gid, with ext
+ *   unless it is NULL. rec->ext is the id of ext. The key is left NULL for
+ *   sf_groups_internowner, unless the extension has no id; then it is built right away.
+ **********************************************************************************************/
+
+void sf_owner_fillrec(sf_filerec_t *rec, const struct stat *info, const char *ext)
+{
+    rec->owner = (uint64_t)info->st_uid << 32 | (uint32_t)info->st_gid;
+    rec->ownerext = ext;
+    rec->ext = ext != NULL ? rec->ext : -1;
+    rec->key = NULL;
+    if (ext != NULL && rec->ext < 0)
+        {
+            sf_owner_fillkey(rec);
+        }
+}
+
+/**********************************************************************************************
+ * sf_owner_fillkey: Build the group key of rec's owner, and extension, into rec->keybuf.
+ **********************************************************************************************/
+
+void sf_owner_fillkey(sf_filerec_t *rec)
+{
+    unsigned uid = rec->owner >> 32, gid = (uint32_t)rec->owner;
+    if (rec->ownerext != NULL)
+        {
+            // the extension may be in keybuf itself
+            char ext[NAME_MAX + 1];
+            snprintf(ext, sizeof(ext), "%s", rec->ownerext);
+            snprintf(rec->keybuf, sizeof(rec->keybuf), "%u:%u/%s", uid, gid, ext);
+        }
+    else
+        {
+            snprintf(rec->keybuf, sizeof(rec->keybuf), "%u:%u", uid, gid);
+        }
+    rec->key = rec->keybuf;
+}
+
+/**********************************************************************************************
+ * sf_owner_split: Read the uid and gid back out of a key and point *ext at its extension,
+ *   "" when there is none. Returns -1 for a key that is not an owner key.
+ **********************************************************************************************/
+
+int sf_owner_split(const char *key, uint32_t *uid, uint32_t *gid, const char **ext)
+{
+    char *end;
+    *uid = strtoul(key, &end, 10);
+    if (end == key || *end != ':')
+        {
+            return -1;
+        }
+    key = end + 1;
+    *gid = strtoul(key, &end, 10);
+    if (end == key || (*end != 0 && *end != '/'))
+        {
+            return -1;
+        }
+    *ext = *end ? end + 1 : end;
+    return 0;
+}
+
+/* The name of a uid, or of a gid with SF_OWNER_GROUPBIT set, looked up the first time */
+static const char *sf_owner_lookup(sumfiles_t *self, uint64_t id)
+{
+    sf_owners_t *owners = self->owners;
+    size_t lo = 0, hi;
+
+    if (owners == NULL)
+        {
+            owners = calloc(1, sizeof(sf_owners_t)); // freed by sf_owner_destroy
+            if (owners == NULL)
+                {
+                    return NULL;
+                }
+            self->owners = owners;
+        }
+    hi = owners->count;
+    while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (owners->names[mid].id < id)
+                {
+                    lo = mid + 1;
+                }
+            else
+                {
+                    hi = mid;
+                }
+        }
+    if (lo < owners->count && owners->names[lo].id == id)
+        {
+            return owners->names[lo].name;
+        }
+
+    if (owners->count == owners->size)
+        {
+            size_t size = owners->size ? owners->size * 2 : 64;
+            struct sf_idname *names = realloc(owners->names, size * sizeof(struct sf_idname));
+            if (names == NULL)
+                {
+                    return NULL;
+                }
+            owners->names = names;
+            owners->size = size;
+        }
+
+    // getpwuid_r / getgrgid_r want room for all of the entry's strings, grow until it fits
+    long bufsize = sysconf((id & SF_OWNER_GROUPBIT) ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+    char *buf = NULL, numbuf[16];
+    const char *name = NULL;
+    int ret = ERANGE;
+    for (bufsize = bufsize > 0 ? bufsize : 1024; ret == ERANGE && bufsize <= 1024 * 1024; bufsize *= 2)
+        {
+            char *grown = realloc(buf, bufsize);
+            if (grown == NULL)
+                {
+                    break;
+                }
+            buf = grown;
+            if ((id & SF_OWNER_GROUPBIT))
+                {
+                    struct group grp, *result = NULL;
+                    ret = getgrgid_r((gid_t)id, &grp, buf, bufsize, &result);
+                    name = result != NULL ? result->gr_name : NULL;
+                }
+            else
+                {
+                    struct passwd pwd, *result = NULL;
+                    ret = getpwuid_r((uid_t)id, &pwd, buf, bufsize, &result);
+                    name = result != NULL ? result->pw_name : NULL;
+                }
+        }
+    if (name == NULL)
+        {
+            // no such user or group any more, show the id
+            snprintf(numbuf, sizeof(numbuf), "%u", (unsigned)id);
+            name = numbuf;
+        }
+    name = sf_arena_strdup(&owners->arena, name);
+    free(buf);
+    if (name == NULL)
+        {
+            return NULL;
+        }
+
+    memmove(&owners->names[lo + 1], &owners->names[lo], (owners->count - lo) * sizeof(struct sf_idname));
+    owners->names[lo].id = id;
+    owners->names[lo].name = name;
+    owners->count++;
+    return name;
+}
+
+/**********************************************************************************************
+ * sf_owner_names: The user and group names of an owner key, "?" when they can not be had.
+ *   For the view thread only, the cache is not locked.
+ **********************************************************************************************/
+
+void sf_owner_names(sumfiles_t *self, const char *key, const char **user, const char **group, const char **ext)
+{
+    uint32_t uid, gid;
+    *user = *group = "?";
+    *ext = "";
+    if (sf_owner_split(key, &uid, &gid, ext) == 0)
+        {
+            const char *name = sf_owner_lookup(self, uid);
+            *user = name != NULL ? name : *user;
+            name = sf_owner_lookup(self, gid | SF_OWNER_GROUPBIT);
+            *group = name != NULL ? name : *group;
+        }
+}
+
+/**********************************************************************************************
+ * sf_owner_label: How an owner key is shown, "user:group" or "user:group/ext".
+ **********************************************************************************************/
+
+char *sf_owner_label(sumfiles_t *self, const char *key, char *buf, size_t size)
+{
+    const char *user, *group, *ext;
+    sf_owner_names(self, key, &user, &group, &ext);
+    snprintf(buf, size, ext[0] || strchr(key, '/') ? "%s:%s/%s" : "%s:%s", user, group, ext);
+    return buf;
+}
+
+void sf_owner_destroy(sf_owners_t *owners)
+{
+    if (owners == NULL)
+        {
+            return;
+        }
+    sf_arena_free(&owners->arena);
+    free(owners->names);
+    free(owners);
+}
@@ -0,0 +1,322 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "summarizefiles.h"
+
+/**
+ * Content worker pool: the traversal hands files whose content has to be read (large files in
+ * --lines mode, all of them with --by-mime) to a few worker threads instead of reading them itself. Every worker counts
+ * into its own group table, like any other scanning thread, with its own libmagic handle.
+ * The queue is bounded, so a traversal that runs ahead of the workers simply waits. A pool
+ * can serve several scans at once, every job carries the scan it belongs to.
+ *
+ * Unless it is given a number of workers, the pool lets its tuner (tune.c) decide how many of
+ * them work: worker i only takes jobs while i is below the limit, so the ones above it never
+ * load libmagic at all. Workers are only started as the limit first reaches them, up to what
+ * sf_tune_cap allows, so a scan the tuner keeps narrow never pays for the threads.
+ *
+ * A checkpoint does not wait for the workers: a job is always either in the queue or marked
+ * as being counted in its worker's group table until the totals it adds are in, so
+ * sf_pool_collect can tell exactly which files the totals of a scan do not hold yet.
+ */
+
+#define SF_POOL_QUEUE 256
+
+struct sf_pooljob
+{
+    sumfiles_t *owner;
+    char *path;
+    size_t baseoff;          // offset of the file name in path
+    struct stat info;
+};
+
+struct sf_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;    // a job was queued or the pool is stopping
+    pthread_cond_t space;    // a job was taken off the queue
+    pthread_cond_t idle;     // the last pending job of a scan finished
+    pthread_cond_t spare;    // the limit went up, for the workers above it
+
+    struct sf_pooljob jobs[SF_POOL_QUEUE];
+    size_t head;
+    size_t count;
+    int busy;                // jobs being worked on
+    int stop;
+
+    pthread_t *threads;
+    int nworkers;            // workers started
+    int cap;                 // the most workers threads has room for
+    int started;             // the index of the next worker to start
+    sf_tune_t *tune;
+    int limit;               // workers taking jobs, the tuner's limit
+};
+
+static void *sf_pool_run(void *arg);
+
+/* Start workers until limit of them run. Called with the lock held */
+static void sf_pool_grow(sf_pool_t *pool, int limit)
+{
+    while (pool->nworkers < limit && pool->nworkers < pool->cap && !pool->stop)
+        {
+            if (pthread_create(&pool->threads[pool->nworkers], NULL, sf_pool_run, pool) != 0)
+                {
+                    break;
+                }
+            pool->nworkers++;
+        }
+}
+
+static void *sf_pool_run(void *arg)
+{
+    sf_pool_t *pool = arg;
+    magic_t magic = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    int worker = pool->started++;
+    for (;;)
+        {
+            while ((pool->count == 0 || worker >= pool->limit) && !pool->stop)
+                {
+                    if (worker >= pool->limit)
+                        {
+                            // a job signalled to this worker goes to one that may take it
+                            if (pool->count > 0)
+                                {
+                                    pthread_cond_signal(&pool->ready);
+                                }
+                            pthread_cond_wait(&pool->spare, &pool->lock);
+                        }
+                    else
+                        {
+                            pthread_cond_wait(&pool->ready, &pool->lock);
+                        }
+                }
+            if (pool->count == 0)
+                {
+                    break;
+                }
+            struct sf_pooljob job = pool->jobs[pool->head];
+            pool->head = (pool->head + 1) % SF_POOL_QUEUE;
+            pool->count--;
+            pool->busy++;
+            // under the pool lock, so the job never falls between queue and table
+            sf_groups_t *groups = sf_localgroups(job.owner);
+            if (groups != NULL)
+                {
+                    pthread_mutex_lock(&groups->lock);
+                    groups->counting = job.path;
+                    pthread_mutex_unlock(&groups->lock);
+                }
+            pthread_cond_signal(&pool->space);
+            pthread_mutex_unlock(&pool->lock);
+
+            uint64_t start = sf_tune_begin(pool->tune);
+            sf_filerec_t rec;
+            if (sf_fillrec(job.owner, &magic, job.path, job.path + job.baseoff, &job.info, &rec) == 0)
+                {
+                    if (job.owner->record != NULL)
+                        {
+                            sf_record_add(job.owner->record, job.path, &job.info, rec.lines);
+                        }
+                    sf_addmapentry(job.owner, job.path, &rec);
+                }
+            if (groups != NULL && groups->counting != NULL)
+                {
+                    // not counted, e.g. the file went away
+                    pthread_mutex_lock(&groups->lock);
+                    groups->counting = NULL;
+                    pthread_mutex_unlock(&groups->lock);
+                }
+            free(job.path);
+            int limit = sf_tune_end(pool->tune, start, job.info.st_size);
+
+            pthread_mutex_lock(&pool->lock);
+            if (limit > pool->limit)
+                {
+                    // more workers may take jobs now
+                    sf_pool_grow(pool, limit);
+                    pthread_cond_broadcast(&pool->spare);
+                }
+            pool->limit = limit;
+            pool->busy--;
+            if (--job.owner->pending == 0)
+                {
+                    pthread_cond_broadcast(&pool->idle);
+                }
+        }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (magic != NULL)
+        {
+            magic_close(magic);
+        }
+    return NULL;
+}
+
+/**********************************************************************************************
+ * sf_pool_new: Start nworkers content workers, to be given to one or more scans through
+ *   sf_config.pool. With nworkers 0 the number working is tuned while the pool runs,
+ *   starting at one per CPU, and workers are started as the tuner asks for them.
+ **********************************************************************************************/
+
+sf_pool_t *sf_pool_new(int nworkers)
+{
+    sf_pool_t *pool = calloc(1, sizeof(sf_pool_t)); // freed by sf_pool_destroy
+    if (pool == NULL)
+        {
+            return NULL;
+        }
+    // every worker holds one file open
+    int cap = nworkers > 0 ? nworkers : sf_tune_cap(1);
+    pool->tune = sf_tune_new("content", nworkers > 0 ? nworkers : sf_tune_cpus(), cap, nworkers > 0);
+    pool->threads = calloc(cap, sizeof(pthread_t));
+    if (pool->tune == NULL || pool->threads == NULL)
+        {
+            sf_tune_destroy(pool->tune);
+            free(pool->threads);
+            free(pool);
+            return NULL;
+        }
+    pool->limit = sf_tune_limit(pool->tune);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pthread_cond_init(&pool->space, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pthread_cond_init(&pool->spare, NULL);
+
+    pool->cap = cap;
+    pthread_mutex_lock(&pool->lock);
+    sf_pool_grow(pool, pool->limit);
+    pthread_mutex_unlock(&pool->lock);
+    if (pool->nworkers == 0)
+        {
+            sf_pool_destroy(pool);
+            return NULL;
+        }
+    return pool;
+}
+
+/**********************************************************************************************
+ * sf_pool_submit: Queue a file of scan self to be summarized by a worker, waiting while the
+ *   queue is full. basefile is the name at the end of fullpath.
+ **********************************************************************************************/
+
+int sf_pool_submit(sf_pool_t *pool, sumfiles_t *self, const char *fullpath, const char *basefile,
+                   const struct stat *info)
+{
+    char *path = strdup(fullpath); // freed by the worker
+    if (path == NULL)
+        {
+            return -1;
+        }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == SF_POOL_QUEUE)
+        {
+            pthread_cond_wait(&pool->space, &pool->lock);
+        }
+    struct sf_pooljob *job = &pool->jobs[(pool->head + pool->count) % SF_POOL_QUEUE];
+    job->owner = self;
+    job->path = path;
+    job->baseoff = strlen(fullpath) - strlen(basefile);
+    job->info = *info;
+    pool->count++;
+    self->pending++;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_pool_drain: Wait until every file queued by scan self has been counted, e.g. before a
+ *   checkpoint records them as done.
+ **********************************************************************************************/
+
+void sf_pool_drain(sf_pool_t *pool, sumfiles_t *self)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (self->pending > 0)
+        {
+            pthread_cond_wait(&pool->idle, &pool->lock);
+        }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**********************************************************************************************
+ * sf_pool_collect: sf_groups_collect for a checkpoint of scan self while its files are still
+ *   being counted. The paths of the files queued or being counted, and so missing from dst,
+ *   are written to inflight. Workers stay blocked on the queue only while the tables merge.
+ **********************************************************************************************/
+
+int sf_pool_collect(sf_pool_t *pool, sumfiles_t *self, sf_groups_t *dst, FILE *inflight)
+{
+    size_t idx;
+    int ret = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (idx = 0; idx < pool->count && ret == 0; idx++)
+        {
+            const struct sf_pooljob *job = &pool->jobs[(pool->head + idx) % SF_POOL_QUEUE];
+            if (job->owner == self)
+                {
+                    ret = sf_putstring(inflight, job->path);
+                }
+        }
+    if (ret == 0)
+        {
+            ret = sf_groups_collect(self, dst, inflight);
+        }
+    pthread_mutex_unlock(&pool->lock);
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_pool_stats: --stats, how many workers the pool settled on.
+ **********************************************************************************************/
+
+void sf_pool_stats(sf_pool_t *pool)
+{
+    if (pool != NULL)
+        {
+            sf_tune_stats(pool->tune);
+        }
+}
+
+void sf_pool_destroy(sf_pool_t *pool)
+{
+    int idx;
+    if (pool == NULL)
+        {
+            return;
+        }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_cond_broadcast(&pool->spare);
+    pthread_mutex_unlock(&pool->lock);
+    for (idx = 0; idx < pool->nworkers; idx++)
+        {
+            pthread_join(pool->threads[idx], NULL);
+        }
+
+    sf_tune_destroy(pool->tune);
+    pthread_cond_destroy(&pool->ready);
+    pthread_cond_destroy(&pool->space);
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->spare);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,218 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "summarizefiles.h"
+
+/**
+ * --record FILE / --replay FILE: record writes every file the scan counts, as the path, mode,
+ * owner, size, mtime and line count it was counted with, and replay feeds those back through
+ * sf_fillrec, sf_addmapentry and the view instead of walking a tree. The grouping, the
+ * aggregation and the drawing can then be timed and profiled on the shape of a real tree at
+ * memory speed, without its disks.
+ *
+ * The file is "SFRC", the version and the options that decide what was counted (--lines,
+ * --decompress), then one record per file: the length of the prefix shared with the previous
+ * path, the rest of the path, the mode, the uid, the gid, the size, the zigzag mtime and the
+ * lines, all varints.
+ * Paths come in traversal order, so most of each is shared with the one before. The extension
+ * is not stored, replay works it out from the path like the scan does. --time buckets are
+ * relative to now, so replaying an old recording shifts files between them.
+ */
+
+#define SF_RECORD_MAGIC "SFRC"
+#define SF_RECORD_VERSION 2
+#define SF_RECORD_MODES (SF_LINES | SF_DECOMPRESS)
+#define SF_RECORD_BUFSIZE (1024 * 1024)
+#define SF_REPLAY_REFRESH 65536
+
+struct sf_record
+{
+    pthread_mutex_t lock;    // scanning threads and content workers record concurrently
+    FILE *out;
+    char *path;              // FILE, for errors
+    char prev[PATH_MAX];     // the path of the previous record
+    int failed;
+};
+
+sf_record_t *sf_record_new(sumfiles_t *self, const char *path)
+{
+    sf_record_t *rec = calloc(1, sizeof(sf_record_t)); // freed by sf_record_close
+    if (rec == NULL)
+        {
+            return NULL;
+        }
+    rec->out = fopen(path, "wb");
+    rec->path = strdup(path);
+    if (rec->out == NULL || rec->path == NULL)
+        {
+            perror(path);
+            if (rec->out != NULL)
+                {
+                    fclose(rec->out);
+                }
+            free(rec->path);
+            free(rec);
+            return NULL;
+        }
+    setvbuf(rec->out, NULL, _IOFBF, SF_RECORD_BUFSIZE);
+    pthread_mutex_init(&rec->lock, NULL);
+    if (fwrite(SF_RECORD_MAGIC, 1, 4, rec->out) != 4
+            || sf_putvarint(rec->out, SF_RECORD_VERSION) != 0
+            || sf_putvarint(rec->out, self->popts & SF_RECORD_MODES) != 0)
+        {
+            rec->failed = 1;
+        }
+    return rec;
+}
+
+/**********************************************************************************************
+ * sf_record_add: Append a counted file to the recording.
+ **********************************************************************************************/
+
+void sf_record_add(sf_record_t *rec, const char *fullpath, const struct stat *info, uint64_t lines)
+{
+    size_t shared = 0;
+
+    pthread_mutex_lock(&rec->lock);
+    while (rec->prev[shared] != 0 && rec->prev[shared] == fullpath[shared])
+        {
+            shared++;
+        }
+    if (sf_putvarint(rec->out, shared) != 0
+            || sf_putstring(rec->out, fullpath + shared) != 0
+            || sf_putvarint(rec->out, info->st_mode) != 0
+            || sf_putvarint(rec->out, info->st_uid) != 0
+            || sf_putvarint(rec->out, info->st_gid) != 0
+            || sf_putvarint(rec->out, info->st_size) != 0
+            || sf_putvarint(rec->out, SF_ZIGZAG(info->st_mtime)) != 0
+            || sf_putvarint(rec->out, lines) != 0)
+        {
+            rec->failed = 1;
+        }
+    snprintf(rec->prev + shared, sizeof(rec->prev) - shared, "%s", fullpath + shared);
+    pthread_mutex_unlock(&rec->lock);
+}
+
+/**********************************************************************************************
+ * sf_record_close: Flush and close the recording, returns -1 when any of it could not be
+ *   written.
+ **********************************************************************************************/
+
+int sf_record_close(sf_record_t *rec)
+{
+    if (rec == NULL)
+        {
+            return 0;
+        }
+    int ret = rec->failed || fclose(rec->out) != 0 ? -1 : 0;
+    if (ret != 0)
+        {
+            perror(rec->path);
+        }
+    pthread_mutex_destroy(&rec->lock);
+    free(rec->path);
+    free(rec);
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_replay: Count the files of a recording as if the scan had found them, refreshing the
+ *   view as the scan would, in place of sf_scan. The time it took goes to --stats.
+ **********************************************************************************************/
+
+int sf_replay(sumfiles_t *self, const char *path)
+{
+    char fullpath[PATH_MAX];
+    struct timespec start, stop;
+    char magic[4];
+    uint64_t version, modes, shared, mode, uid, gid, size, mtime, lines;
+    int ret = 0;
+
+    snprintf(self->rootpath, sizeof(self->rootpath), "replay of %.1000s", path);
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+        {
+            perror(path);
+            return -1;
+        }
+    setvbuf(in, NULL, _IOFBF, SF_RECORD_BUFSIZE);
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, SF_RECORD_MAGIC, 4) != 0
+            || sf_getvarint(in, &version) != 0 || version != SF_RECORD_VERSION
+            || sf_getvarint(in, &modes) != 0)
+        {
+            fprintf(stderr, "%s: not a recording written by this version\n", path);
+            fclose(in);
+            return -1;
+        }
+    if ((self->popts & SF_RECORD_MODES) != (int)modes)
+        {
+            // the line counts are whatever the recording run counted
+            fprintf(stderr, "%s: recorded with%s --lines%s, the line counts are replayed as recorded\n", path,
+                    (modes & SF_LINES) ? "" : "out", (modes & SF_DECOMPRESS) ? " --decompress" : "");
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fullpath[0] = 0;
+    while (sf_getvarint(in, &shared) == 0)
+        {
+            struct stat info;
+            sf_filerec_t rec;
+
+            if (shared > strlen(fullpath)
+                    || sf_getstring(in, fullpath + shared, sizeof(fullpath) - shared) != 0
+                    || sf_getvarint(in, &mode) != 0
+                    || sf_getvarint(in, &uid) != 0
+                    || sf_getvarint(in, &gid) != 0
+                    || sf_getvarint(in, &size) != 0
+                    || sf_getvarint(in, &mtime) != 0
+                    || sf_getvarint(in, &lines) != 0)
+                {
+                    fprintf(stderr, "%s: recording is truncated\n", path);
+                    ret = -1;
+                    break;
+                }
+            memset(&info, 0, sizeof(info));
+            info.st_mode = mode;
+            info.st_uid = uid;
+            info.st_gid = gid;
+            info.st_size = size;
+            info.st_mtime = SF_UNZIGZAG(mtime);
+
+            const char *basefile = strrchr(fullpath, '/');
+            basefile = basefile != NULL ? basefile + 1 : fullpath;
+            if (info.st_mtime < self->min_mod_time)
+                {
+                    self->min_mod_time = info.st_mtime;
+                }
+            if (info.st_mtime > self->max_mod_time)
+                {
+                    self->max_mod_time = info.st_mtime;
+                }
+            if (sf_fillrec(self, &self->magic_session, fullpath, basefile, &info, &rec) == 0)
+                {
+                    rec.lines = lines;
+                    sf_addmapentry(self, fullpath, &rec);
+                }
+            if (++self->replayed % SF_REPLAY_REFRESH == 0)
+                {
+                    sf_refreshview(self);
+                }
+        }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    self->replay_nanos += (stop.tv_sec - start.tv_sec) * 1000000000ULL + stop.tv_nsec - start.tv_nsec;
+    fclose(in);
+    return ret;
+}
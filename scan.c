@@ -0,0 +1,1261 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+/* pthread_timedjoin_np */
+#define _GNU_SOURCE
+
+/* We want POSIX.1-2008 + XSI, i.e. SuSv4, features */
+#define _XOPEN_SOURCE 700
+
+/* Added on 2017-06-25:
+   If the C library can support 64-bit file sizes
+   and offsets, using the standard names,
+   these defines tell the C library to do so. */
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fts.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "summarizefiles.h"
+
+int sf_getconsolesize(sumfiles_t *self);
+
+int sf_compare_fts(const FTSENT** one, const FTSENT** two)
+{
+    //printf("foo(%s, %s)", (*one)->fts_name, (*two)->fts_name);
+    return (strcmp((*one)->fts_name, (*two)->fts_name));
+}
+
+/**********************************************************************************************
+ * sf_othershard: --shard, whether a top level entry of the root belongs to another shard. The
+ *   entries are spread by a hash of their name, so every process of a sharded scan picks the
+ *   same split without talking to the others.
+ **********************************************************************************************/
+
+int sf_othershard(sumfiles_t *self, const char *name)
+{
+    return self->shards > 1 && sf_hashkey(name) % self->shards != (unsigned long)self->shard;
+}
+
+/* The entries of a directory, stated together */
+struct sf_statbatch
+{
+    sumfiles_t *self;
+    FTSENT **entries;
+    struct stat *infos;
+    int *rets;
+    size_t size;
+};
+
+static int sf_statbatch_grow(struct sf_statbatch *batch)
+{
+    size_t size = batch->size ? batch->size * 2 : 256;
+    FTSENT **entries = realloc(batch->entries, size * sizeof(FTSENT *));
+    if (entries == NULL)
+        {
+            return -1;
+        }
+    batch->entries = entries;
+    struct stat *infos = realloc(batch->infos, size * sizeof(struct stat));
+    if (infos == NULL)
+        {
+            return -1;
+        }
+    batch->infos = infos;
+    int *rets = realloc(batch->rets, size * sizeof(int));
+    if (rets == NULL)
+        {
+            return -1;
+        }
+    batch->rets = rets;
+    batch->size = size;
+    return 0;
+}
+
+static uint64_t sf_statentry(void *arg, size_t idx)
+{
+    struct sf_statbatch *batch = arg;
+    FTSENT *child = batch->entries[idx];
+    char filepath[ strlen(child->fts_path) + strlen(child->fts_name) + 1 ];
+    sprintf( filepath, "%s%s", child->fts_path, child->fts_name );
+    uint64_t start = sf_throttle_begin(batch->self->throttle, 0);
+    batch->rets[idx] = lstat( filepath, &batch->infos[idx]);
+    sf_throttle_end(batch->self->throttle, start, 0);
+    return 1;
+}
+
+/* --resume: count the files the content workers had not counted when the checkpoint was taken */
+static void sf_resumefiles(sumfiles_t *self)
+{
+    struct stat info;
+    size_t idx;
+    for (idx = 0; idx < self->nresume; idx++)
+        {
+            const char *basefile = strrchr(self->resume_files[idx], '/');
+            if (lstat(self->resume_files[idx], &info) == 0)
+                {
+                    sf_addentry(self, self->resume_files[idx], basefile != NULL ? basefile + 1 : self->resume_files[idx],
+                                &info);
+                }
+            free(self->resume_files[idx]);
+        }
+    free(self->resume_files);
+    self->resume_files = NULL;
+    self->nresume = 0;
+    self->merged = 0;
+}
+
+/**********************************************************************************************
+ * sf_summarize: Walk the tree under rootpath and count its files. fts only reads the
+ *   directories; the entries of each are stated in one batch, several at once when the stat
+ *   tuner finds that pays, and then counted in the order fts gave them.
+ **********************************************************************************************/
+
+int sf_summarize(sumfiles_t *self)
+{
+    if ((self->popts & SF_DEBUG))
+        {
+            fprintf(stderr, "sf_sumarize(%s)\n", self->rootpath);
+        }
+    FTS* file_system = NULL;
+    FTSENT* child = NULL;
+    FTSENT* parent = NULL;
+    FTSENT* skipped = NULL;
+    struct sf_statbatch batch = { self, NULL, NULL, NULL, 0 };
+
+    // --resume: where this root was left off, NULL once the traversal is past that point
+    const char *cursor = NULL;
+    if (self->resume_cursor[0] && self->rootidx == self->resume_root)
+        {
+            cursor = self->resume_cursor;
+            sf_resumefiles(self);
+        }
+
+    //char rootargv[1][strlen(self->rootpath)+1];
+    //strcpy(rootargv[0], self->rootpath);
+    char *ftsargv[2] = { self->rootpath, NULL };
+    // checkpoints describe the frontier by a directory name, that needs a stable order
+    // FTS_NOSTAT: fts stats the directories only, the files are stated below
+    file_system = fts_open(ftsargv,FTS_COMFOLLOW | FTS_NOCHDIR | FTS_PHYSICAL | FTS_NOSTAT,
+                           self->checkpoint ? sf_compare_fts : NULL);
+
+    if (file_system != NULL)
+        {
+            while( (parent = fts_read(file_system)) != NULL)
+                {
+                    int countfiles = 1;
+
+                    if (parent->fts_info == FTS_DP)
+                        {
+                            if (parent == skipped)
+                                {
+                                    // fts reports a skipped directory as finished right away
+                                    continue;
+                                }
+                            // only an ancestor of the cursor finishes while it is still set,
+                            //   everything after this is new
+                            cursor = NULL;
+                            if (self->checkpoint != NULL
+                                    && time(NULL) - self->last_checkpoint >= self->checkpoint_interval)
+                                {
+                                    // the files still with the workers go into the checkpoint
+                                    sf_checkpoint_write(self, self->rootidx, parent->fts_path);
+                                }
+                            continue;
+                        }
+
+                    if (parent->fts_info == FTS_D && parent->fts_level == 1
+                            && sf_othershard(self, parent->fts_name))
+                        {
+                            fts_set(file_system, parent, FTS_SKIP);
+                            skipped = parent;
+                            continue;
+                        }
+
+                    if (parent->fts_info == FTS_D && cursor != NULL)
+                        {
+                            int position = sf_checkpoint_position(parent->fts_path, cursor);
+                            if (position == SF_RESUME_DONE)
+                                {
+                                    fts_set(file_system, parent, FTS_SKIP);
+                                    skipped = parent;
+                                    continue;
+                                }
+                            if (position == SF_RESUME_ANCESTOR)
+                                {
+                                    // entered before the checkpoint, its files are counted
+                                    countfiles = 0;
+                                }
+                            else
+                                {
+                                    cursor = NULL;
+                                }
+                        }
+
+                    if (parent->fts_info == FTS_D && self->watch != NULL)
+                        {
+                            sf_watch_adddir(self->watch, parent->fts_path);
+                        }
+                    errno = 0;
+                    if (parent->fts_info == FTS_D)
+                        {
+                            // only a directory's children cost a read, a file's are free
+                            uint64_t start = sf_throttle_begin(self->throttle, 0);
+                            child = fts_children(file_system,0);
+                            sf_throttle_end(self->throttle, start, 0);
+                        }
+                    else
+                        {
+                            child = fts_children(file_system,0);
+                        }
+
+                    if (errno != 0)
+                        {
+                            perror("fts_children call failed");
+                        }
+
+                    size_t nchildren = 0, idx;
+                    for (; countfiles && child != NULL; child = child->fts_link)
+                        {
+                            //printf("%s%s\n", child->fts_path, child->fts_name);
+                            if (parent->fts_level == 0 && sf_othershard(self, child->fts_name))
+                                {
+                                    continue;
+                                }
+                            if (nchildren == batch.size && sf_statbatch_grow(&batch) != 0)
+                                {
+                                    __sync_fetch_and_add(&self->exceptions, 1);
+                                    break;
+                                }
+                            batch.entries[nchildren++] = child;
+                        }
+                    if (self->stattune != NULL)
+                        {
+                            sf_tune_run(self->stattune, nchildren, sf_statentry, &batch);
+                        }
+                    else
+                        {
+                            for (idx = 0; idx < nchildren; idx++)
+                                {
+                                    sf_statentry(&batch, idx);
+                                }
+                        }
+                    for (idx = 0; idx < nchildren; idx++)
+                        {
+                            child = batch.entries[idx];
+                            char filepath[ strlen(child->fts_path) + strlen(child->fts_name) + 1 ];
+                            sprintf( filepath, "%s%s", child->fts_path, child->fts_name );
+                            if (batch.rets[idx]==0)
+                                {
+                                    sf_addentry(self, filepath, child->fts_name, &batch.infos[idx]);
+                                }
+                        }
+                }
+            fts_close(file_system);
+        }
+    free(batch.entries);
+    free(batch.infos);
+    free(batch.rets);
+
+    if (self->pool != NULL)
+        {
+            sf_pool_drain(self->pool, self);
+        }
+    if (self->checkpoint != NULL)
+        {
+            // this root is done, a resume starts with the next one
+            sf_checkpoint_write(self, self->rootidx + 1, "");
+        }
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_new: Init the structure containing state info used by the summarizefiles set of
+ *    functions.
+ **********************************************************************************************/
+
+sumfiles_t *sf_new(int popts)
+{
+    static unsigned long scan_ids = 0;
+    sumfiles_t *self = malloc(sizeof(sumfiles_t)); // freed by sf_close
+
+    self->scan_id = __sync_add_and_fetch(&scan_ids, 1);
+    pthread_mutex_init(&self->lock, NULL);
+    self->groups = NULL;
+    self->order = NULL;
+    self->order_size = 0;
+    self->where = NULL;
+    self->shown = NULL;
+    self->nshown = 0;
+    self->magic_session = NULL;
+    self->pool = NULL;
+    self->stattune = NULL;
+    self->record = NULL;
+    self->throttle = NULL;
+    self->owners = NULL;
+    self->mime_detected = 0;
+    self->mime_cached = 0;
+    self->nomagic = 0;
+    self->dupes = NULL;
+    self->replayed = 0;
+    self->replay_nanos = 0;
+    memset(self->codecstats, 0, sizeof(self->codecstats));
+    self->watch = NULL;
+    self->estimate = NULL;
+    self->probes = 0;
+    self->ci = NULL;
+    self->cisize = 0;
+    self->checkpoint = NULL;
+    self->checkpoint_interval = 5;
+    self->last_checkpoint = time(NULL);
+    self->rootidx = 0;
+    self->resume_root = 0;
+    self->shard = 0;
+    self->shards = 0;
+    strcpy(self->resume_cursor, "");
+    self->resume_files = NULL;
+    self->nresume = 0;
+    memset(&self->config, 0, sizeof(self->config));
+    self->ownpool = 0;
+    self->pending = 0;
+    self->rootcount = 0;
+    self->finished = 0;
+    self->results = NULL;
+    self->results_size = 0;
+    if (sf_groups_init(&self->snapshot) != 0)
+        {
+            perror("Unable to allocate the group table");
+            free(self);
+            return NULL;
+        }
+    if (sf_groups_init(&self->rollup) != 0)
+        {
+            perror("Unable to allocate the group table");
+            sf_groups_destroy(&self->snapshot);
+            free(self);
+            return NULL;
+        }
+    if ( (popts & SF_HIST) )
+        {
+            // the thread tables copy their flags from the snapshot
+            self->snapshot.flags |= SF_GROUPS_HIST;
+            self->rollup.flags |= SF_GROUPS_HIST;
+        }
+    if ( (popts & SF_DUPES) )
+        {
+            self->snapshot.flags |= SF_GROUPS_DUPES;
+            self->rollup.flags |= SF_GROUPS_DUPES;
+        }
+    //self->popts = SF_EXT; // + SF_DEBUG;
+    //self->popts = SF_TIME;
+    // self->popts = SF_LINES;
+    self->popts = popts;
+    self->console_cols = 80;
+    self->console_rows = 30;
+    self->last_refresh = 0;
+    self->colsize = 40;
+    self->min_mod_time = INT_MAX;
+    self->max_mod_time = 0;
+    self->exceptions = 0;
+    strcpy(self->rootpath, "");
+    strcpy(self->rootpathdisp, "");
+
+    if ( (self->popts & SF_DEBUG) )
+        {
+            fprintf(stderr, "Debug Mode!\n");
+        }
+
+    if ( (self->popts & SF_TIME) )
+        {
+            // TODO choose a colsize based on console width?
+            self->colsize = 50;
+        }
+    if ( (self->popts & SF_ESTIMATE) )
+        {
+            // room for the confidence interval
+            self->colsize = 50;
+        }
+    if ( (self->popts & SF_OWNER) )
+        {
+            // room for user and group names
+            self->colsize += 12;
+        }
+    if ( (self->popts & SF_MIME) )
+        {
+            // room for the type and the encoding
+            self->colsize += 20;
+        }
+    if ( (self->popts & SF_DUPES) )
+        {
+            // room for the bytes in copies
+            self->colsize += 16;
+        }
+    if ( (self->popts & SF_HIST) )
+        {
+            // room for the sparkline
+            self->colsize += 12;
+        }
+    // libmagic is loaded by sf_loadmagic once a file needs it
+
+    sf_getconsolesize(self);
+    if (self->colsize > self->console_cols)
+        {
+            // a column wider than the console would only be cut
+            self->colsize = self->console_cols;
+        }
+
+    return self;
+}
+
+
+/**********************************************************************************************
+ * sf_refreshview: As info accumulates in the hashmap, decide if it is an auspicious time
+ *    to update the view of the progress.
+ **********************************************************************************************/
+
+int sf_refreshview(sumfiles_t *self)
+{
+    if ( strlen(self->rootpathdisp)==0 && strlen(self->rootpath)>0 )
+        {
+            // Compute the chars allocated to displaying the root path on the status line
+            //   and truncate the value as necessary
+            char sbuf[sizeof(self->rootpath)];
+            int rootpathlen = strlen(self->rootpath);
+
+            if (self->console_cols<=83 || rootpathlen + 78 < self->console_cols)
+                {
+                    // plenty of room to display the full length
+                    snprintf(self->rootpathdisp, sizeof(self->rootpathdisp), "%s", self->rootpath);
+                }
+            else
+                {
+                    // rootpath needs to be shortened
+                    rootpathlen = self->console_cols - 78 -2;
+                    if (strlen(self->rootpath)<rootpathlen)
+                        {
+                            // unreachable
+                            // rootpathlen=strlen(self-rootpath);
+                            snprintf(self->rootpathdisp, sizeof(self->rootpathdisp), "%s", self->rootpath);
+                        }
+                    else
+                        {
+                            substr(self->rootpath, -1, rootpathlen, sbuf );
+                            snprintf(self->rootpathdisp, sizeof(self->rootpathdisp), "..%s", sbuf);
+                        }
+                }
+        }
+
+    // --json writes the totals once, when the scan is done
+    if ( (self->popts & (SF_DEBUG | SF_JSON)) == 0 )
+        {
+            //time_t now = time(NULL);
+            //if (self->last_refresh == 0 || (now - self->last_refresh) > 1)
+            //      {
+            sf_show(self);
+            //          self->last_refresh=now;
+            //      }
+        }
+}
+
+/**********************************************************************************************
+ * sf_addmapentry: Adapter function to perform the work necessary to add the information
+ *   to the calling thread's group table. Look at the table entry by key, add the info for the
+ *   entry if found, otherwise start a new entry. Keys and labels are copied into the table's
+ *   arena the first time a group is seen, so the steady state does not allocate. A key that is
+ *   a bare extension comes with its id (rec->ext, -1 otherwise) and is looked up by that, an
+ *   owner key that was not built by its ids. With --top the file is offered to the group's
+ *   lists of largest and newest files under fullpath.
+ **********************************************************************************************/
+
+int32_t sf_addmapentry(sumfiles_t *self, const char *fullpath, sf_filerec_t *rec)
+{
+    uint64_t fbytes = rec->bytes, flines = rec->lines;
+    time_t fmtime = rec->mtime;
+
+    sf_groups_t *groups = sf_localgroups(self);
+    if (groups == NULL)
+        {
+            __sync_fetch_and_add(&self->exceptions, 1);
+            return -1;
+        }
+
+    pthread_mutex_lock(&groups->lock);
+    int32_t id = rec->key == NULL ? sf_groups_internowner(groups, rec)
+                 : rec->ext >= 0 ? sf_groups_internext(groups, rec->ext, rec->key)
+                 : sf_groups_intern(groups, rec->key, rec->label, 1);
+    const char *key = id >= 0 ? groups->key[id] : rec->key;
+    if (id >= 0)
+        {
+            sf_groups_add(groups, id, fbytes, 1, flines, fmtime, fmtime);
+            if (groups->hist != NULL)
+                {
+                    groups->hist[id * SF_HIST_BUCKETS + SF_HIST_BUCKET(fbytes)]++;
+                }
+            if (groups->topn > 0
+                    && (sf_groups_top(groups, id, SF_TOP_LARGEST, fbytes, fullpath, 1) != 0
+                        || sf_groups_top(groups, id, SF_TOP_NEWEST, fmtime, fullpath, 1) != 0))
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                }
+        }
+    else
+        {
+            __sync_fetch_and_add(&self->exceptions, 1);
+        }
+    // a content worker's job is counted, in the same hold of the lock as its totals
+    groups->counting = NULL;
+    pthread_mutex_unlock(&groups->lock);
+
+    if (id >= 0 && self->config.on_file != NULL)
+        {
+            struct sf_fileinfo file = { fullpath, key, rec->label, fbytes, flines, fmtime };
+            self->config.on_file(self->config.cbdata, &file);
+        }
+    return id;
+}
+
+
+/**********************************************************************************************
+ * sf_loadmagic: Return the libmagic handle in *magic, opening it and loading the database the
+ *   first time. Loading the database dominates startup, so runs that never classify a file
+ *   never pay for it. Each thread keeps its own handle. NULL when the database can not be
+ *   loaded, the callers then skip the file; it is tried and reported once per scan.
+ **********************************************************************************************/
+
+magic_t sf_loadmagic(sumfiles_t *self, magic_t *magic)
+{
+    if (*magic == NULL && !self->nomagic)
+        {
+            magic_t session = magic_open(MAGIC_MIME|MAGIC_CHECK);
+            if (session == NULL || magic_load(session, NULL) != 0)
+                {
+                    if (__sync_bool_compare_and_swap(&self->nomagic, 0, 1))
+                        {
+                            fprintf(stderr, "Unable to load libmagic database: %s\n",
+                                    session != NULL ? magic_error(session) : strerror(errno));
+                        }
+                    if (session != NULL)
+                        {
+                            magic_close(session);
+                        }
+                    return NULL;
+                }
+            *magic = session;
+        }
+    return *magic;
+}
+
+/**********************************************************************************************
+ * sf_addentry_byext: Add an entry to the hashmap performing any tasks related to a
+ *   summary by extension.
+ **********************************************************************************************/
+
+int sf_addentry_byext(sumfiles_t *self, magic_t *magic, const char *fullpath, const char *basefile,
+                      const struct stat *info, sf_filerec_t *rec)
+{
+
+    const char *ext;
+    rec->ext = sf_ext_intern(basefile, rec->keybuf, sizeof(rec->keybuf), &ext);
+    if ((self->popts & SF_DEBUG) )
+        {
+            fprintf(stderr, "ext=%s\n", ext);
+        }
+    uint64_t lines = 0;
+
+    if ((self->popts & (SF_LINES | SF_REPLAY)) == SF_LINES && info->st_size > 0)
+        {
+            // count the lines of text files, see content.c. Replay has them recorded
+            if (sf_content_lines(self, magic, fullpath, &lines) != 0)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                }
+        }
+
+    rec->key = ext;
+    rec->label = "";
+    rec->bytes = info->st_size;
+    rec->lines = lines;
+    rec->mtime = info->st_mtime;
+    return 0;
+} //|
+
+/**********************************************************************************************
+ * sf_addentry_bytime: Add an entry to the hashmap performing any tasks related to a
+ *   summary by time. E.g. group files by their temporal proximity to each other.
+ **********************************************************************************************/
+
+int sf_addentry_bytime(sumfiles_t *self, const char *fullpath, const char *basefile, const struct stat *info,
+                       sf_filerec_t *rec)
+{
+    //printf("[bytime] %s\n", filepath);
+    time_t tnow = time(NULL);
+    struct tm *tm_tmp;
+    long oneday = 24 * 60 * 60;
+    long onemonth = tnow - 30 * oneday;
+    long oneyear = tnow - 365 * oneday;
+
+    tm_tmp = localtime( &tnow );
+
+    char *month_g = "03month";
+    char *year_g = "02year";
+    char *old_g = "01old";
+    char *day = rec->labelbuf;
+
+    //printf("Select the group: %d onemonth=%d oneyear=%d\n", info->st_mtime,
+    //	     onemonth - info->st_mtime, oneyear - info->st_mtime
+    //	 );
+    char *group = year_g;
+    char *dayfmt = "%Y%m";
+    if (info->st_mtime<oneyear)
+        {
+            group = old_g;
+            dayfmt = "%Y";
+        }
+    else
+        {
+            if (info->st_mtime>onemonth)
+                {
+                    group = month_g;
+                    dayfmt ="%Y%m%d";
+                }
+        }
+
+    //printf("group=%s, dayfmt=%s\n", group, dayfmt);
+    struct tm mtime;
+    localtime_r(&(info->st_mtime), &mtime);
+    strftime(day, sizeof(rec->labelbuf), dayfmt,  &mtime);
+    //printf("group=%s, day=%s\n", group, day);
+
+    snprintf(rec->keybuf, sizeof(rec->keybuf), "%s.%s", group, day);
+
+    rec->key = rec->keybuf;
+    rec->ext = -1;
+    rec->label = day;
+    rec->bytes = info->st_size;
+    rec->lines = 0;
+    rec->mtime = info->st_mtime;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_fillrec: Work out which group a file belongs to and what it contributes, without adding
+ *   it anywhere. magic holds the libmagic handle of the calling thread, NULL until --lines
+ *   first needs it.
+ *   Returns -1 for the files that are not summarized.
+ **********************************************************************************************/
+
+static int sf_skipfile(const char *basefile, const struct stat *info)
+{
+    if (basefile[0] == '.')
+        {
+            // hidden file, move on
+            return 1;
+        }
+
+    if ( (info->st_mode & S_IFREG) == 0)
+        {
+            // Not a file, move on
+            return 1;
+        }
+    return 0;
+}
+
+int sf_fillrec(sumfiles_t *self, magic_t *magic, const char *fullpath, const char *basefile,
+               const struct stat *info, sf_filerec_t *rec)
+{
+    if (sf_skipfile(basefile, info))
+        {
+            return -1;
+        }
+
+    if ( (self->popts & SF_CUBE) )
+        {
+            // both coordinates of the cell, the time bucket first since it fills the buffers
+            sf_filerec_t bytime;
+            if (sf_addentry_bytime(self, fullpath, basefile, info, &bytime) != 0
+                    || sf_addentry_byext(self, magic, fullpath, basefile, info, rec) != 0)
+                {
+                    return -1;
+                }
+            strcpy(rec->labelbuf, bytime.labelbuf);
+            rec->label = rec->labelbuf;
+            sf_cube_fillkey(rec, rec->key, bytime.keybuf);
+            rec->ext = -1;
+            return 0;
+        }
+
+    if ( (self->popts & SF_OWNER) )
+        {
+            // the extension part also counts the lines for --lines
+            if (sf_addentry_byext(self, magic, fullpath, basefile, info, rec) != 0)
+                {
+                    return -1;
+                }
+            sf_owner_fillrec(rec, info, (self->popts & SF_OWNEREXT) ? rec->key : NULL);
+            return 0;
+        }
+
+    if ( (self->popts & SF_MIME) )
+        {
+            return sf_addentry_bymime(self, magic, fullpath, info, rec);
+        }
+
+    if ( (self->popts & SF_EXT)  || (self->popts & SF_LINES) )
+        {
+            return sf_addentry_byext(self, magic, fullpath, basefile, info, rec);
+        }
+
+    if ( (self->popts & SF_TIME)  )
+        {
+            return sf_addentry_bytime(self, fullpath, basefile, info, rec);
+        }
+
+    return -1;
+}
+
+/**********************************************************************************************
+ * sf_addentry: Add an entry to the hashmap. Perform any other checks and tasks required for adding
+ *   the file entry.
+ **********************************************************************************************/
+
+int sf_addentry(sumfiles_t *self, const char *fullpath, const char *basefile, const struct stat *info)
+{
+    sf_filerec_t rec;
+    if (sf_skipfile(basefile, info))
+        {
+            return 0;
+        }
+
+    if (info->st_mtime < self->min_mod_time)
+        {
+            self->min_mod_time = info->st_mtime;
+        }
+    if (info->st_mtime > self->max_mod_time)
+        {
+            self->max_mod_time = info->st_mtime;
+        }
+
+    if (self->popts & SF_DEBUG)
+        {
+            sf_refreshview(self);
+        }
+
+    if (self->dupes != NULL && sf_dupes_add(self->dupes, fullpath, basefile, info) != 0)
+        {
+            // counted, but not compared
+            __sync_fetch_and_add(&self->exceptions, 1);
+        }
+
+    if (self->pool != NULL && (((self->popts & SF_LINES) && info->st_size >= SF_POOL_MINSIZE)
+                               || ((self->popts & SF_MIME) && info->st_size > 0)))
+        {
+            // reading a large file is the slow part, let a content worker count it. --by-mime
+            //   reads the head of every file
+            if (sf_pool_submit(self->pool, self, fullpath, basefile, info) != 0)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                }
+            return 0;
+        }
+
+    if (sf_fillrec(self, &self->magic_session, fullpath, basefile, info, &rec) != 0)
+        {
+            return 0;
+        }
+
+    if (self->record != NULL)
+        {
+            sf_record_add(self->record, fullpath, info, rec.lines);
+        }
+    int32_t id = sf_addmapentry(self, fullpath, &rec);
+    if (id >= 0 && self->watch != NULL)
+        {
+            // remember what the file contributed, so a later change can be applied as a delta
+            sf_groups_t *groups = sf_localgroups(self);
+            sf_watch_track(self->watch, fullpath, groups->key[id], groups->label[id], &rec);
+        }
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_show: Iterate thru the file groups discovered so far and prepare them into a list for
+ *  display by the view functions.
+ **********************************************************************************************/
+
+void sf_show(sumfiles_t *self)
+{
+    sf_groups_reset(&self->snapshot);
+    self->probes = 0;
+    if (self->estimate != NULL)
+        {
+            // until the full scan is done the sampled estimates stand in for it
+            self->probes = sf_estimate_fill(self->estimate, &self->snapshot, &self->ci, &self->cisize,
+                                            (self->popts & SF_LINES) ? 2 : 0);
+            if (self->probes == 0)
+                {
+                    // a fill that gave up may have left the earlier roots behind
+                    sf_groups_reset(&self->snapshot);
+                }
+        }
+
+    if (self->probes == 0)
+        {
+            // Merge the per thread tables into the snapshot, the keys are borrowed from the tables
+            sf_groups_collect(self, &self->snapshot, NULL);
+        }
+
+    // --cube shows a slice of the cells, --json and library callers get the cells themselves
+    int library = self->config.on_progress != NULL || self->config.on_result != NULL;
+    int every = (self->popts & SF_JSON) || library;
+    sf_groups_t *shown = &self->snapshot;
+    if ((self->popts & SF_CUBE) && !every)
+        {
+            if (sf_cube_rollup(self, &self->snapshot, &self->rollup, self->where) != 0)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    return;
+                }
+            shown = &self->rollup;
+        }
+
+    if (self->order_size < shown->count)
+        {
+            uint32_t *order = realloc(self->order, shown->count * sizeof(uint32_t));
+            if (order == NULL)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    return;
+                }
+            self->order = order;
+            self->order_size = shown->count;
+        }
+
+    // Only the columns needed to filter are touched here, the view sorts the permutation
+    int residx=0;
+    uint32_t id;
+    for (id = 0; id < shown->count; id++)
+        {
+            // --json is for other programs, they get every group
+            if (every)
+                {
+                    self->order[residx++] = id;
+                }
+            else if (shown->bytes[id]>1024)
+                {
+                    if ((self->popts & SF_LINES)==0 || shown->lines[id]>0)
+                        {
+                            self->order[residx++] = id;
+                        }
+                }
+        }
+
+    self->shown = shown;
+    self->nshown = residx;
+    if (library)
+        {
+            // a library caller draws nothing, it may only want the final result
+            sf_groups_cb callback = self->finished ? self->config.on_result : self->config.on_progress;
+            if (callback != NULL)
+                {
+                    sf_showcallback(self, shown, self->order, residx, callback);
+                }
+        }
+    else if ((self->popts & SF_JSON))
+        {
+            sf_showjson(self, shown, self->order, residx);
+        }
+    else
+        {
+            sf_showresults(self, shown, self->order, residx);
+        }
+}
+
+int sf_getconsolesize(sumfiles_t *self)
+{
+    struct winsize ws;
+
+    // scripted runs have no terminal to size, the defaults from sf_new stand
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0
+            && ws.ws_row > 0 && ws.ws_col > 0)
+        {
+            self->console_rows = ws.ws_row;
+            self->console_cols = ws.ws_col;
+            return 0;
+        }
+    return -1;
+}
+
+/**********************************************************************************************
+ * sf_close: Destroy the state information and all it's dependent objects.
+ **********************************************************************************************/
+
+void sf_close(sumfiles_t *self)
+{
+    // the workers count into tables of their own, stop them first. A shared pool keeps
+    //   running for the other scans once this one's files are counted.
+    if (self->ownpool)
+        {
+            sf_pool_destroy(self->pool);
+        }
+    else if (self->pool != NULL)
+        {
+            sf_pool_drain(self->pool, self);
+        }
+    sf_tune_destroy(self->stattune);
+    sf_record_close(self->record);
+    sf_throttle_destroy(self->throttle);
+    sf_owner_destroy(self->owners);
+    sf_dupes_destroy(self->dupes);
+
+    // Clean up after the run. Every group, key and label lives in one of the table arenas,
+    //   so this is a few frees per thread rather than one per group.
+    sf_groups_t *groups = self->groups;
+    while (groups != NULL)
+        {
+            sf_groups_t *chain = groups->chain;
+            sf_groups_destroy(groups);
+            free(groups);
+            groups = chain;
+        }
+    sf_groups_destroy(&self->snapshot);
+    sf_groups_destroy(&self->rollup);
+    free(self->order);
+    free(self->results);
+    free(self->ci);
+    sf_estimate_destroy(self->estimate);
+    sf_watch_destroy(self->watch);
+    while (self->nresume > 0)
+        {
+            free(self->resume_files[--self->nresume]);
+        }
+    free(self->resume_files);
+
+    if (self->magic_session != NULL)
+        {
+            magic_close(self->magic_session);
+        }
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+
+static void *mt_run(void * arg)
+{
+    sumfiles_t *self = (sumfiles_t *)arg;
+    sf_summarize(self);
+    return NULL;
+}
+
+static const long MSEC_IN_NANO = 1000000000 / 1000;
+
+static void mt_main(sumfiles_t *self)
+{
+    pthread_t child;
+
+    pthread_create( &child, NULL, mt_run, self);
+    int join_ret=EBUSY;
+    void *thread_exit;
+    struct timespec ts;
+
+    while( join_ret == EBUSY || join_ret == ETIMEDOUT  )
+        {
+            // Update the console view, while the child analysis the tree
+            sf_refreshview(self);
+
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+                {
+                    perror("clock_gettime");
+                }
+            // wake up 300ms from now, not at the next 300ms mark within the current second
+            ts.tv_nsec += 300 * MSEC_IN_NANO;
+            if (ts.tv_nsec >= 1000 * MSEC_IN_NANO)
+                {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000 * MSEC_IN_NANO;
+                }
+
+            join_ret = pthread_timedjoin_np(child, &thread_exit, &ts);
+        }
+    switch(join_ret)
+        {
+        case EBUSY:
+            fprintf(stderr, "join_ret=EBUSY\n");
+            break;
+        case EINVAL:
+            fprintf(stderr, "join_ret=EINVAL\n");
+            break;
+        case ETIMEDOUT:
+            fprintf(stderr, "join_ret=ETIMEDOUT\n");
+            break;
+        }
+
+
+}
+
+/**********************************************************************************************
+ * sf_config_init: The defaults sf.exe runs with, the number of workers tuned as it goes.
+ **********************************************************************************************/
+
+void sf_config_init(struct sf_config *config)
+{
+    memset(config, 0, sizeof(struct sf_config));
+    config->checkpoint_interval = 5;
+}
+
+/**********************************************************************************************
+ * sf_open: Start a scan as configured. Nothing is read until sf_scan. Returns NULL, having
+ *   said why on stderr, when the scan can not be set up.
+ **********************************************************************************************/
+
+sumfiles_t *sf_open(const struct sf_config *config)
+{
+    // before any thread is started, they inherit it
+    if (config->idle && sf_throttle_idle() != 0)
+        {
+            return NULL;
+        }
+    int popts = config->popts;
+    if ( (popts & SF_TIME) == 0 && (popts & SF_LINES) == 0)
+        {
+            // default to a summary by extension
+            popts = popts | SF_EXT;
+        }
+
+    sumfiles_t *self = sf_new(popts);
+    if (self == NULL)
+        {
+            return NULL;
+        }
+    self->config = *config;
+
+    self->where = config->where;
+    if (config->top > 0)
+        {
+            // the thread tables copy topn from the snapshot
+            self->snapshot.topn = config->top;
+            self->rollup.topn = config->top;
+        }
+    self->checkpoint = config->checkpoint;
+    self->checkpoint_interval = config->checkpoint_interval;
+    if (config->shards > 0)
+        {
+            self->shard = config->shard - 1;
+            self->shards = config->shards;
+        }
+    if (config->resume)
+        {
+            if (config->checkpoint == NULL)
+                {
+                    fprintf(stderr, "--resume needs the --checkpoint FILE to resume from\n");
+                    sf_close(self);
+                    return NULL;
+                }
+            if ((self->popts & SF_DUPES))
+                {
+                    // the candidates found before the checkpoint are not in it
+                    fprintf(stderr, "--dupes can not be resumed\n");
+                    sf_close(self);
+                    return NULL;
+                }
+            if (sf_checkpoint_load(self) != 0)
+                {
+                    sf_close(self);
+                    return NULL;
+                }
+        }
+
+    if ((self->popts & SF_WATCH))
+        {
+            self->watch = sf_watch_new();
+            if (self->watch == NULL)
+                {
+                    sf_close(self);
+                    return NULL;
+                }
+        }
+
+    if (config->max_iops > 0 || config->max_bandwidth > 0 || config->max_latency > 0)
+        {
+            self->throttle = sf_throttle_new(config->max_iops, config->max_bandwidth, config->max_latency);
+            if (self->throttle == NULL)
+                {
+                    sf_close(self);
+                    return NULL;
+                }
+        }
+
+    if ((self->popts & SF_DUPES))
+        {
+            self->dupes = sf_dupes_new();
+            if (self->dupes == NULL)
+                {
+                    sf_close(self);
+                    return NULL;
+                }
+        }
+
+    if (config->record != NULL)
+        {
+            self->record = sf_record_new(self, config->record);
+            if (self->record == NULL)
+                {
+                    sf_close(self);
+                    return NULL;
+                }
+        }
+
+    if ((self->popts & (SF_LINES | SF_MIME)) && (self->popts & (SF_WATCH | SF_DEBUG | SF_REPLAY)) == 0)
+        {
+            // --watch needs every file's contribution at hand, --debug stays single threaded,
+            //   --replay reads no content
+            if (config->pool != NULL)
+                {
+                    self->pool = config->pool;
+                }
+            else
+                {
+                    self->pool = sf_pool_new(config->workers);
+                    self->ownpool = 1;
+                }
+        }
+    if ((self->popts & (SF_DEBUG | SF_REPLAY)) == 0)
+        {
+            // starts at one stat in flight, sf_summarize does without when this fails
+            self->stattune = sf_tune_new("stat", 1, sf_tune_cap(0), 0);
+        }
+    return self;
+}
+
+/**********************************************************************************************
+ * sf_scan: Count the files under root into the scan, refreshing the view (or calling
+ *   on_progress) while it runs. Called once per root, the totals add up across them.
+ **********************************************************************************************/
+
+int sf_scan(sumfiles_t *self, const char *root)
+{
+    char rootbuf[PATH_MAX];
+
+    self->rootidx = self->rootcount++;
+    if (self->config.resume && self->rootidx < self->resume_root)
+        {
+            // finished before the checkpoint
+            snprintf(self->rootpath, sizeof(self->rootpath), "%s", root);
+            return 0;
+        }
+    if (self->watch != NULL)
+        {
+            // events arrive with absolute paths, scan with the same spelling
+            if (realpath(root, rootbuf) != NULL)
+                {
+                    root = rootbuf;
+                }
+            if (sf_watch_addroot(self->watch, root) != 0)
+                {
+                    return -1;
+                }
+        }
+    snprintf(self->rootpath, sizeof(self->rootpath), "%s", root);
+    if ((self->popts & SF_ESTIMATE))
+        {
+            // sampled totals stand in for the root until it is scanned, see estimate.c
+            self->estimate = sf_estimate_start(self, root);
+        }
+    int ret = 0;
+    if ((self->popts & SF_DEBUG))
+        {
+            // Use a single thread for debugging
+            if (sf_summarize(self))
+                {
+                    fprintf(stderr, "%s.\n", strerror(errno));
+                    ret = -1;
+                }
+        }
+    else
+        {
+            mt_main(self);
+        }
+    // the exact totals are in, drop the estimates
+    sf_estimate_destroy(self->estimate);
+    self->estimate = NULL;
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_watch: Once the roots are scanned, stop the recording and with SF_WATCH follow the
+ *   changes to them, refreshing the view, until sf_interrupt. Returns -1 when the recording
+ *   could not be written or the events could not be read.
+ **********************************************************************************************/
+
+int sf_watch(sumfiles_t *self)
+{
+    // the recording stops with the scan, --watch changes are not part of it
+    int ret = sf_record_close(self->record);
+    self->record = NULL;
+    if (self->watch != NULL && sf_watch_run(self) != 0)
+        {
+            ret = -1;
+        }
+    return ret;
+}
+
+/**********************************************************************************************
+ * sf_interrupt: Have sf_watch return within its next poll. Safe to call from a signal
+ *   handler; the library installs none, the caller decides which signals stop a watch.
+ **********************************************************************************************/
+
+void sf_interrupt(sumfiles_t *self)
+{
+    if (self != NULL)
+        {
+            sf_watch_interrupt(self->watch);
+        }
+}
+
+/**********************************************************************************************
+ * sf_finish: Show the totals of every root scanned, or hand them to on_result. With --dupes
+ *   the files of all the roots are compared first. Unless a callback takes the totals, --top
+ *   lists follow them, and with --stats the numbers of the scan go to stderr. Returns -1 when
+ *   some of the files could not be counted.
+ **********************************************************************************************/
+
+int sf_finish(sumfiles_t *self)
+{
+    if (self->dupes != NULL)
+        {
+            sf_dupes_resolve(self, self->dupes);
+        }
+    self->finished = 1;
+    sf_show(self);
+    int library = self->config.on_progress != NULL || self->config.on_result != NULL;
+    if (self->config.top > 0 && (self->popts & SF_JSON) == 0 && !library)
+        {
+            sf_showtop(self);
+        }
+    if ((self->popts & SF_STATS))
+        {
+            sf_showstats(self);
+            sf_throttle_stats(self->throttle);
+        }
+    return self->exceptions > 0 ? -1 : 0;
+}
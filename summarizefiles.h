@@ -10,12 +10,157 @@
  ** Create an issue at the project for consideration to merge the pull request.
  */
 
+#include <stdio.h>
+#include <sys/stat.h>
 #include "models.h"
 
 int mysystem(char *strbuf, char *cmd, int buffer_size);
 char *strtrim(char *str);
 char* substr(const char* str, int start, int length, char *sbuf);
-void sf_showresults(sumfiles_t *self, sumentry_t *results, size_t result_size);
-char *se_show(sumfiles_t *self, sumentry_t *entry, char *sbufentry);
+void sf_showresults(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size);
+void sf_showstats(sumfiles_t *self);
+void sf_showtop(sumfiles_t *self);
+void sf_showjson(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size);
+void sf_showcallback(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size,
+                     sf_groups_cb callback);
+char *se_show(sumfiles_t *self, sf_groups_t *groups, uint32_t id, char *sbufentry, size_t size);
 char *show_size(char *strbuf, size_t bytes);
 
+void *sf_arena_alloc(sf_arena_t *arena, size_t size);
+char *sf_arena_strdup(sf_arena_t *arena, const char *str);
+void sf_arena_reset(sf_arena_t *arena);
+void sf_arena_free(sf_arena_t *arena);
+
+/* FNV-1a, the hash of group keys and of the extension table mkexttab generates */
+#define SF_FNV_BASIS 14695981039346656037UL
+#define SF_FNV_STEP(hash, c) (((hash) ^ (unsigned char)(c)) * 1099511628211UL)
+
+unsigned long sf_hashkey(const char *key);
+int sf_groups_init(sf_groups_t *groups);
+int32_t sf_groups_intern(sf_groups_t *groups, const char *key, const char *label, int copy);
+int32_t sf_groups_find(sf_groups_t *groups, const char *key);
+int32_t sf_groups_internext(sf_groups_t *groups, int32_t ext, const char *key);
+int32_t sf_groups_internowner(sf_groups_t *groups, sf_filerec_t *rec);
+void sf_groups_add(sf_groups_t *groups, uint32_t id, uint64_t bytes, uint64_t files, uint64_t lines,
+                   time_t min_mtime, time_t max_mtime);
+int sf_groups_top(sf_groups_t *groups, uint32_t id, int list, int64_t value, const char *path, int copy);
+void sf_groups_fold(sf_groups_t *dst, uint32_t into, sf_groups_t *src, uint32_t id);
+int sf_groups_merge(sf_groups_t *dst, sf_groups_t *src);
+int sf_groups_collect(sumfiles_t *self, sf_groups_t *dst, FILE *inflight);
+void sf_groups_reset(sf_groups_t *groups);
+void sf_groups_destroy(sf_groups_t *groups);
+sf_groups_t *sf_localgroups(sumfiles_t *self);
+
+magic_t sf_loadmagic(sumfiles_t *self, magic_t *magic);
+int32_t sf_addmapentry(sumfiles_t *self, const char *fullpath, sf_filerec_t *rec);
+int sf_fillrec(sumfiles_t *self, magic_t *magic, const char *fullpath, const char *basefile,
+               const struct stat *info, sf_filerec_t *rec);
+int sf_addentry(sumfiles_t *self, const char *fullpath, const char *basefile, const struct stat *info);
+int sf_refreshview(sumfiles_t *self);
+sumfiles_t *sf_new(int popts);
+int sf_othershard(sumfiles_t *self, const char *name);
+int sf_summarize(sumfiles_t *self);
+void sf_show(sumfiles_t *self);
+
+sf_watch_t *sf_watch_new(void);
+int sf_watch_addroot(sf_watch_t *watch, const char *rootpath);
+void sf_watch_track(sf_watch_t *watch, const char *fullpath, const char *key, const char *label,
+                    const sf_filerec_t *rec);
+void sf_watch_adddir(sf_watch_t *watch, const char *dirpath);
+int sf_watch_run(sumfiles_t *self);
+void sf_watch_interrupt(sf_watch_t *watch);
+void sf_watch_destroy(sf_watch_t *watch);
+
+
+sf_estimate_t *sf_estimate_start(sumfiles_t *self, const char *root);
+uint64_t sf_estimate_fill(sf_estimate_t *est, sf_groups_t *snapshot, double **ci, size_t *cisize, int measure);
+void sf_estimate_stop(sf_estimate_t *est);
+void sf_estimate_destroy(sf_estimate_t *est);
+
+/* file content is read in chunks of this size */
+#define SF_CONTENT_CHUNK (64 * 1024)
+
+extern const char *sf_codec_names[SF_CODECS];
+int sf_content_lines(sumfiles_t *self, magic_t *magic, const char *fullpath, uint64_t *lines);
+
+const char *sf_mime_detect(sumfiles_t *self, magic_t *magic, const char *fullpath, int fd,
+                           const struct stat *info);
+int sf_addentry_bymime(sumfiles_t *self, magic_t *magic, const char *fullpath, const struct stat *info,
+                       sf_filerec_t *rec);
+const char *sf_mime_split(const char *key, char *buf, size_t size, const char **charset);
+
+/* files at least this large are counted by the content workers */
+#define SF_POOL_MINSIZE (256 * 1024)
+int sf_pool_submit(sf_pool_t *pool, sumfiles_t *self, const char *fullpath, const char *basefile,
+                   const struct stat *info);
+void sf_pool_drain(sf_pool_t *pool, sumfiles_t *self);
+int sf_pool_collect(sf_pool_t *pool, sumfiles_t *self, sf_groups_t *dst, FILE *inflight);
+void sf_pool_stats(sf_pool_t *pool);
+
+int sf_tune_cpus(void);
+int sf_tune_cap(int fds);
+sf_tune_t *sf_tune_new(const char *name, int start, int cap, int fixed);
+uint64_t sf_tune_begin(sf_tune_t *t);
+int sf_tune_end(sf_tune_t *t, uint64_t start, uint64_t units);
+int sf_tune_limit(sf_tune_t *t);
+void sf_tune_run(sf_tune_t *t, size_t count, uint64_t (*fn)(void *arg, size_t idx), void *arg);
+void sf_tune_stats(sf_tune_t *t);
+void sf_tune_destroy(sf_tune_t *t);
+
+/* Extension ids, see ext.c. The longest extension in the generated table, and where the
+ * extension with that hash goes in it given its bucket's displacement. */
+#define SF_EXT_NONE 0
+#define SF_EXT_MAXLEN 15
+#define SF_EXTTAB_SLOT(hash, displace, mask) \
+    (((((hash) ^ ((uint64_t)(displace) * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL) >> 40) & (mask))
+
+int32_t sf_ext_intern(const char *basefile, char *keybuf, size_t size, const char **name);
+
+void sf_cube_fillkey(sf_filerec_t *rec, const char *ext, const char *timekey);
+size_t sf_cube_split(const char *key, const char **timekey);
+int sf_cube_rollup(sumfiles_t *self, sf_groups_t *cells, sf_groups_t *rollup, const char *where);
+
+/* zigzag maps small negative numbers to small varints */
+#define SF_ZIGZAG(v)   (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define SF_UNZIGZAG(v) ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+int sf_putvarint(FILE *out, uint64_t value);
+int sf_getvarint(FILE *in, uint64_t *value);
+int sf_putstring(FILE *out, const char *str);
+int sf_getstring(FILE *in, char *buf, size_t size);
+int sf_dump_groups(FILE *out, sf_groups_t *groups);
+int sf_load_groups(FILE *in, sf_groups_t *groups);
+int sf_dump_modes(int popts);
+
+sf_dupes_t *sf_dupes_new(void);
+int sf_dupes_add(sf_dupes_t *dupes, const char *fullpath, const char *basefile, const struct stat *info);
+int sf_dupes_resolve(sumfiles_t *self, sf_dupes_t *dupes);
+void sf_dupes_stats(sf_dupes_t *dupes);
+void sf_dupes_destroy(sf_dupes_t *dupes);
+
+void sf_owner_fillrec(sf_filerec_t *rec, const struct stat *info, const char *ext);
+void sf_owner_fillkey(sf_filerec_t *rec);
+int sf_owner_split(const char *key, uint32_t *uid, uint32_t *gid, const char **ext);
+void sf_owner_names(sumfiles_t *self, const char *key, const char **user, const char **group, const char **ext);
+char *sf_owner_label(sumfiles_t *self, const char *key, char *buf, size_t size);
+void sf_owner_destroy(sf_owners_t *owners);
+
+sf_throttle_t *sf_throttle_new(double iops, double bandwidth, double latency_ms);
+uint64_t sf_throttle_begin(sf_throttle_t *t, uint64_t bytes);
+void sf_throttle_end(sf_throttle_t *t, uint64_t start, uint64_t unused);
+int sf_throttle_idle(void);
+void sf_throttle_stats(sf_throttle_t *t);
+void sf_throttle_destroy(sf_throttle_t *t);
+
+sf_record_t *sf_record_new(sumfiles_t *self, const char *path);
+void sf_record_add(sf_record_t *rec, const char *fullpath, const struct stat *info, uint64_t lines);
+int sf_record_close(sf_record_t *rec);
+
+
+#define SF_RESUME_DONE     0
+#define SF_RESUME_ANCESTOR 1
+#define SF_RESUME_AFTER    2
+
+int sf_checkpoint_write(sumfiles_t *self, int rootidx, const char *cursor);
+int sf_checkpoint_load(sumfiles_t *self);
+int sf_checkpoint_position(const char *dir, const char *cursor);
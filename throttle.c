@@ -0,0 +1,238 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "summarizefiles.h"
+
+/**
+ * Throttling for scans of busy hosts. Every stat and every content read goes through
+ * sf_throttle_begin / sf_throttle_end, shared by all the threads of the scan:
+ *
+ * --max-iops and --max-bandwidth are token buckets, refilled at the limit and holding at most
+ * SF_THROTTLE_BURST seconds worth. An operation takes its tokens right away and, when that puts
+ * a bucket in debt, sleeps until the debt is paid, so the threads queue up fairly behind it.
+ *
+ * --max-latency watches how long the operations take. While the smoothed latency is above the
+ * limit the delay added to every operation doubles, once per SF_THROTTLE_ADJUST, and once it is
+ * back below the delay halves away again.
+ */
+
+#define SF_THROTTLE_BURST     0.1                   // seconds of tokens a bucket holds
+#define SF_THROTTLE_CHUNK     (64 * 1024)           // the largest single read
+#define SF_THROTTLE_ADJUST    (100 * 1000000ULL)    // ns between backoff changes
+#define SF_THROTTLE_MINDELAY  (100 * 1000ULL)
+#define SF_THROTTLE_MAXDELAY  (1000 * 1000000ULL)
+
+// <linux/ioprio.h> is not in every libc's reach
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS 1
+#endif
+#define SF_IOPRIO_CLASS_IDLE 3
+#define SF_IOPRIO_CLASS_SHIFT 13
+
+struct sf_throttle
+{
+    pthread_mutex_t lock;
+    double iops;             // limits, 0 for none
+    double bandwidth;
+    uint64_t latency;        // ns
+    double optokens;
+    double bytetokens;
+    uint64_t refilled;       // when the buckets were last topped up
+
+    double ewma;             // smoothed latency, ns
+    uint64_t delay;          // backoff added to every operation, ns
+    uint64_t adjusted;       // when the delay last changed
+
+    // --stats
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t waits;
+    uint64_t waitnanos;
+    uint64_t maxdelay;
+};
+
+static uint64_t sf_nanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static double sf_throttle_cap(double rate, double least)
+{
+    return rate * SF_THROTTLE_BURST > least ? rate * SF_THROTTLE_BURST : least;
+}
+
+/**********************************************************************************************
+ * sf_throttle_new: A throttle for iops operations and bandwidth bytes per second, backing off
+ *   when operations take longer than latency_ms. Any of them can be 0 to leave it out.
+ **********************************************************************************************/
+
+sf_throttle_t *sf_throttle_new(double iops, double bandwidth, double latency_ms)
+{
+    sf_throttle_t *t = calloc(1, sizeof(sf_throttle_t)); // freed by sf_throttle_destroy
+    if (t == NULL)
+        {
+            return NULL;
+        }
+    pthread_mutex_init(&t->lock, NULL);
+    t->iops = iops;
+    t->bandwidth = bandwidth;
+    t->latency = latency_ms * 1000000.0;
+    t->optokens = sf_throttle_cap(iops, 1);
+    t->bytetokens = sf_throttle_cap(bandwidth, SF_THROTTLE_CHUNK);
+    t->refilled = sf_nanos();
+    return t;
+}
+
+/**********************************************************************************************
+ * sf_throttle_begin: Wait for the turn of an operation that moves bytes, e.g. a stat (0) or
+ *   a read. Returns its start time for sf_throttle_end. A NULL throttle never waits.
+ **********************************************************************************************/
+
+uint64_t sf_throttle_begin(sf_throttle_t *t, uint64_t bytes)
+{
+    if (t == NULL)
+        {
+            return 0;
+        }
+
+    double wait = 0;
+    pthread_mutex_lock(&t->lock);
+    uint64_t now = sf_nanos(); // after the lock, so refilled never runs ahead of it
+    double elapsed = (now - t->refilled) / 1e9;
+    t->refilled = now;
+    if (t->iops > 0)
+        {
+            double cap = sf_throttle_cap(t->iops, 1);
+            t->optokens += elapsed * t->iops;
+            t->optokens = (t->optokens > cap ? cap : t->optokens) - 1;
+            if (t->optokens < 0)
+                {
+                    wait = -t->optokens / t->iops;
+                }
+        }
+    if (t->bandwidth > 0)
+        {
+            double cap = sf_throttle_cap(t->bandwidth, SF_THROTTLE_CHUNK);
+            t->bytetokens += elapsed * t->bandwidth;
+            t->bytetokens = (t->bytetokens > cap ? cap : t->bytetokens) - bytes;
+            if (t->bytetokens < 0 && -t->bytetokens / t->bandwidth > wait)
+                {
+                    wait = -t->bytetokens / t->bandwidth;
+                }
+        }
+    uint64_t sleepns = wait * 1e9 + t->delay;
+    t->ops++;
+    t->bytes += bytes;
+    if (sleepns > 0)
+        {
+            t->waits++;
+            t->waitnanos += sleepns;
+        }
+    pthread_mutex_unlock(&t->lock);
+
+    if (sleepns > 0)
+        {
+            struct timespec ts = { sleepns / 1000000000ULL, sleepns % 1000000000ULL };
+            nanosleep(&ts, NULL);
+            now = sf_nanos();
+        }
+    return now;
+}
+
+/**********************************************************************************************
+ * sf_throttle_end: The operation started at start is done, account for its latency. unused
+ *   is what it moved less than sf_throttle_begin was told, e.g. by a short read, and goes back
+ *   into the bucket.
+ **********************************************************************************************/
+
+void sf_throttle_end(sf_throttle_t *t, uint64_t start, uint64_t unused)
+{
+    if (t == NULL)
+        {
+            return;
+        }
+
+    uint64_t now = sf_nanos();
+    double latency = now - start;
+    pthread_mutex_lock(&t->lock);
+    t->bytetokens += unused;
+    t->bytes -= unused;
+    if (t->latency == 0)
+        {
+            pthread_mutex_unlock(&t->lock);
+            return;
+        }
+    t->ewma = t->ewma == 0 ? latency : t->ewma + (latency - t->ewma) / 8;
+    if (now - t->adjusted >= SF_THROTTLE_ADJUST)
+        {
+            if (t->ewma > t->latency)
+                {
+                    t->delay = t->delay == 0 ? SF_THROTTLE_MINDELAY : t->delay * 2;
+                    t->delay = t->delay > SF_THROTTLE_MAXDELAY ? SF_THROTTLE_MAXDELAY : t->delay;
+                    t->maxdelay = t->delay > t->maxdelay ? t->delay : t->maxdelay;
+                }
+            else
+                {
+                    t->delay = t->delay / 2 < SF_THROTTLE_MINDELAY ? 0 : t->delay / 2;
+                }
+            t->adjusted = now;
+        }
+    pthread_mutex_unlock(&t->lock);
+}
+
+/**********************************************************************************************
+ * sf_throttle_idle: --idle, move the process to the idle I/O scheduling class, so the disks
+ *   serve it only when nothing else wants them. Threads created afterwards inherit it.
+ **********************************************************************************************/
+
+int sf_throttle_idle(void)
+{
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, SF_IOPRIO_CLASS_IDLE << SF_IOPRIO_CLASS_SHIFT) != 0)
+        {
+            perror("ioprio_set");
+            return -1;
+        }
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_throttle_stats: --stats, how much the throttle held the scan back, on stderr.
+ **********************************************************************************************/
+
+void sf_throttle_stats(sf_throttle_t *t)
+{
+    char sizebuf[32];
+    if (t == NULL)
+        {
+            return;
+        }
+    fprintf(stderr, "throttle %" PRIu64 " operations, %s read, waited %.3f s in %" PRIu64 " waits, backoff up to %.1f ms\n",
+            t->ops, show_size(sizebuf, t->bytes), t->waitnanos / 1e9, t->waits, t->maxdelay / 1e6);
+}
+
+void sf_throttle_destroy(sf_throttle_t *t)
+{
+    if (t == NULL)
+        {
+            return;
+        }
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
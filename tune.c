@@ -0,0 +1,448 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+/* sched_getaffinity */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "summarizefiles.h"
+
+/**
+ * Adaptive concurrency: how many stats or reads are worth having in flight depends on what is
+ * underneath, a few on a single disk, dozens on NFS or a parallel filesystem. A tuner gates
+ * the operations of one kind (the stats of the traversal, the content workers, the --dupes
+ * hashing) to a limit it adjusts while the scan runs, from what it measures over windows of
+ * SF_TUNE_WINDOW:
+ *
+ *   - additive increase: while the window used every slot and the throughput held up, one
+ *     more operation is let in flight.
+ *   - multiplicative decrease: when the last increase made the throughput drop, or latency
+ *     climbed far above the lowest seen without the throughput gaining, the limit shrinks by
+ *     a quarter. The queueing is then in the device, not in the scan.
+ *
+ * The limit never goes past the cap sf_tune_cap works out from the CPU quota of the cgroup
+ * and the file descriptors left under RLIMIT_NOFILE. A tuner made with a fixed limit (e.g.
+ * --workers N) only gates and measures.
+ *
+ * sf_tune_run also has threads of its own to spread a batch of operations over, the
+ * traversal uses it to stat the entries of a directory concurrently. They are started as the
+ * limit reaches them, also in the middle of a batch, e.g. a --dupes hashing stage.
+ */
+
+#define SF_TUNE_WINDOW    (200 * 1000000ULL)   // ns of operations between adjustments
+#define SF_TUNE_GAIN      0.05                 // throughput change taken as real, not noise
+#define SF_TUNE_CONGESTED 4.0                  // latency over the lowest seen that is queueing
+#define SF_TUNE_PERCPU    8                    // I/O bound threads per CPU of the quota
+#define SF_TUNE_MAX       256
+#define SF_TUNE_FDRESERVE 32                   // stdio, fts, --record, libmagic, ...
+
+struct sf_tune
+{
+    pthread_mutex_t lock;
+    pthread_cond_t slot;     // an operation finished, or a batch is ready
+    pthread_cond_t done;     // the last operation of the batch finished
+    const char *name;
+    int limit;
+    int cap;
+    int fixed;
+    int inflight;
+
+    // the window being measured
+    uint64_t winstart;
+    uint64_t winops;
+    uint64_t winunits;       // what the throughput counts, operations or bytes
+    uint64_t winnanos;       // latency summed over the operations
+    int winpeak;
+    double lastrate;
+    int lastlimit;
+    double minlat;
+
+    // sf_tune_run
+    uint64_t (*fn)(void *arg, size_t idx);
+    void *arg;
+    size_t count;
+    size_t next;
+    size_t finished;
+    pthread_t *threads;
+    int nthreads;
+    int stop;
+
+    // --stats
+    uint64_t ops;
+    uint64_t nanos;
+    int lowest;
+    int highest;
+    uint64_t increases;
+    uint64_t decreases;
+};
+
+static uint64_t sf_tune_nanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* The CPUs the cgroup may use, from cpu.max (v2) or cfs_quota_us (v1), 0 when unlimited */
+static double sf_tune_quota(void)
+{
+    long long quota = -1, period = 0;
+    char max[32];
+    FILE *in = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (in != NULL)
+        {
+            if (fscanf(in, "%31s %lld", max, &period) == 2 && strcmp(max, "max") != 0)
+                {
+                    quota = atoll(max);
+                }
+            fclose(in);
+        }
+    else if ((in = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL)
+        {
+            if (fscanf(in, "%lld", &quota) != 1)
+                {
+                    quota = -1;
+                }
+            fclose(in);
+            in = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+            if (in == NULL || fscanf(in, "%lld", &period) != 1)
+                {
+                    quota = -1;
+                }
+            if (in != NULL)
+                {
+                    fclose(in);
+                }
+        }
+    return quota > 0 && period > 0 ? (double)quota / period : 0;
+}
+
+/**********************************************************************************************
+ * sf_tune_cpus: The CPUs the process may run on: its affinity mask, or the CPU quota of its
+ *   cgroup rounded up when that is less.
+ **********************************************************************************************/
+
+int sf_tune_cpus(void)
+{
+    cpu_set_t cpus;
+    double ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double quota = sf_tune_quota();
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+        {
+            ncpus = CPU_COUNT(&cpus);
+        }
+    if (quota > 0 && quota < ncpus)
+        {
+            ncpus = quota;
+        }
+    return ncpus < 1 ? 1 : (int)(ncpus + 0.999);
+}
+
+/**********************************************************************************************
+ * sf_tune_cap: The most operations worth having in flight at once, each holding fds file
+ *   descriptors: SF_TUNE_PERCPU per CPU of sf_tune_cpus, and no more than the descriptors
+ *   left under RLIMIT_NOFILE.
+ **********************************************************************************************/
+
+int sf_tune_cap(int fds)
+{
+    struct rlimit files;
+    int cap = sf_tune_cpus() * SF_TUNE_PERCPU;
+
+    cap = cap > SF_TUNE_MAX ? SF_TUNE_MAX : cap;
+    if (fds > 0 && getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY)
+        {
+            long left = ((long)files.rlim_cur - SF_TUNE_FDRESERVE) / fds;
+            cap = left < 1 ? 1 : left < cap ? left : cap;
+        }
+    return cap;
+}
+
+/**********************************************************************************************
+ * sf_tune_new: A tuner for name's operations, starting at start in flight and going up to
+ *   cap. With fixed the limit stays at start.
+ **********************************************************************************************/
+
+sf_tune_t *sf_tune_new(const char *name, int start, int cap, int fixed)
+{
+    sf_tune_t *t = calloc(1, sizeof(sf_tune_t)); // freed by sf_tune_destroy
+    if (t == NULL)
+        {
+            return NULL;
+        }
+    cap = cap < 1 ? 1 : cap;
+    t->threads = calloc(cap, sizeof(pthread_t));
+    if (t->threads == NULL)
+        {
+            free(t);
+            return NULL;
+        }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->slot, NULL);
+    pthread_cond_init(&t->done, NULL);
+    t->name = name;
+    t->cap = cap;
+    t->limit = start < 1 ? 1 : start > t->cap ? t->cap : start;
+    t->fixed = fixed;
+    t->lowest = t->highest = t->limit;
+    t->winstart = sf_tune_nanos();
+    return t;
+}
+
+static void *sf_tune_worker(void *arg);
+
+/* Start threads for a running batch until the limit of them work, the calling thread being
+ * one. Called with the lock held */
+static void sf_tune_grow(sf_tune_t *t)
+{
+    while (t->fn != NULL && t->count > 1 && t->next < t->count && !t->stop && t->nthreads < t->limit - 1)
+        {
+            if (pthread_create(&t->threads[t->nthreads], NULL, sf_tune_worker, t) != 0)
+                {
+                    break;
+                }
+            t->nthreads++;
+        }
+}
+
+/* A window is over, move the limit. Called with the lock held */
+static void sf_tune_adjust(sf_tune_t *t, uint64_t now)
+{
+    double rate = t->winunits / ((now - t->winstart) / 1e9);
+    double latency = (double)t->winnanos / t->winops;
+    int limit = t->limit;
+
+    t->minlat = t->minlat == 0 || latency < t->minlat ? latency : t->minlat + (latency - t->minlat) / 64;
+    if (!t->fixed)
+        {
+            int grew = t->lastlimit > 0 && t->lastlimit < t->limit;
+            int gained = t->lastrate == 0 || rate > t->lastrate * (1 + SF_TUNE_GAIN);
+            int held = t->lastrate == 0 || rate >= t->lastrate * (1 - SF_TUNE_GAIN);
+            if ((grew && !held) || (latency > t->minlat * SF_TUNE_CONGESTED && !gained))
+                {
+                    limit = limit * 3 / 4 < limit - 1 ? limit * 3 / 4 : limit - 1;
+                    limit = limit < 1 ? 1 : limit;
+                }
+            else if (t->winpeak >= t->limit && held && limit < t->cap)
+                {
+                    limit++;
+                }
+        }
+
+    if (limit > t->limit)
+        {
+            t->increases++;
+        }
+    else if (limit < t->limit)
+        {
+            t->decreases++;
+        }
+    t->lastlimit = t->limit;
+    t->lastrate = rate;
+    t->limit = limit;
+    t->lowest = limit < t->lowest ? limit : t->lowest;
+    t->highest = limit > t->highest ? limit : t->highest;
+    t->winstart = now;
+    t->winops = 0;
+    t->winunits = 0;
+    t->winnanos = 0;
+    t->winpeak = t->inflight;
+    if (limit > t->lastlimit)
+        {
+            sf_tune_grow(t);
+        }
+    pthread_cond_broadcast(&t->slot);
+}
+
+/* An operation started at start is done. Called with the lock held */
+static void sf_tune_account(sf_tune_t *t, uint64_t start, uint64_t units)
+{
+    uint64_t now = sf_tune_nanos();
+    t->inflight--;
+    t->ops++;
+    t->nanos += now - start;
+    t->winops++;
+    t->winunits += units;
+    t->winnanos += now - start;
+    if (now - t->winstart >= SF_TUNE_WINDOW)
+        {
+            sf_tune_adjust(t, now);
+        }
+    pthread_cond_signal(&t->slot);
+}
+
+/**********************************************************************************************
+ * sf_tune_begin: An operation starts, for callers that keep to sf_tune_limit themselves, e.g.
+ *   by letting only that many of their threads work. Returns its start time for sf_tune_end.
+ **********************************************************************************************/
+
+uint64_t sf_tune_begin(sf_tune_t *t)
+{
+    pthread_mutex_lock(&t->lock);
+    t->inflight++;
+    t->winpeak = t->inflight > t->winpeak ? t->inflight : t->winpeak;
+    pthread_mutex_unlock(&t->lock);
+    return sf_tune_nanos();
+}
+
+/**********************************************************************************************
+ * sf_tune_end: The operation started at start is done. units is what it counts towards the
+ *   throughput, 1 for an operation or the bytes it read. Returns the limit from now on.
+ **********************************************************************************************/
+
+int sf_tune_end(sf_tune_t *t, uint64_t start, uint64_t units)
+{
+    pthread_mutex_lock(&t->lock);
+    sf_tune_account(t, start, units);
+    int limit = t->limit;
+    pthread_mutex_unlock(&t->lock);
+    return limit;
+}
+
+int sf_tune_limit(sf_tune_t *t)
+{
+    pthread_mutex_lock(&t->lock);
+    int limit = t->limit;
+    pthread_mutex_unlock(&t->lock);
+    return limit;
+}
+
+/* Take the next operation of the batch once a slot is free, -1 when there is none left or
+ * the tuner is stopping. Called with the lock held */
+static ssize_t sf_tune_take(sf_tune_t *t, int worker)
+{
+    while (!t->stop && (t->fn == NULL || t->next == t->count || t->inflight >= t->limit))
+        {
+            if (!worker && (t->fn == NULL || t->next == t->count))
+                {
+                    // the caller stops taking once the batch is handed out
+                    return -1;
+                }
+            pthread_cond_wait(&t->slot, &t->lock);
+        }
+    if (t->stop)
+        {
+            return -1;
+        }
+    t->inflight++;
+    t->winpeak = t->inflight > t->winpeak ? t->inflight : t->winpeak;
+    return t->next++;
+}
+
+/* Run one operation of the batch and account for it. Called with the lock held */
+static void sf_tune_one(sf_tune_t *t, size_t idx)
+{
+    uint64_t (*fn)(void *arg, size_t idx) = t->fn;
+    void *arg = t->arg;
+    pthread_mutex_unlock(&t->lock);
+    uint64_t start = sf_tune_nanos();
+    uint64_t units = fn(arg, idx);
+    pthread_mutex_lock(&t->lock);
+    sf_tune_account(t, start, units);
+    if (++t->finished == t->count)
+        {
+            pthread_cond_signal(&t->done);
+        }
+}
+
+static void *sf_tune_worker(void *arg)
+{
+    sf_tune_t *t = arg;
+    ssize_t idx;
+
+    pthread_mutex_lock(&t->lock);
+    while ((idx = sf_tune_take(t, 1)) >= 0)
+        {
+            sf_tune_one(t, idx);
+        }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/**********************************************************************************************
+ * sf_tune_run: Call fn(arg, idx) for every idx below count, with up to the limit of them at
+ *   once on the tuner's threads and the calling thread, and return when all are done. fn
+ *   returns the units of sf_tune_end. One batch at a time.
+ **********************************************************************************************/
+
+void sf_tune_run(sf_tune_t *t, size_t count, uint64_t (*fn)(void *arg, size_t idx), void *arg)
+{
+    ssize_t idx;
+
+    if (count == 0)
+        {
+            return;
+        }
+    pthread_mutex_lock(&t->lock);
+    t->fn = fn;
+    t->arg = arg;
+    t->count = count;
+    t->next = 0;
+    t->finished = 0;
+    sf_tune_grow(t);
+    pthread_cond_broadcast(&t->slot);
+    while ((idx = sf_tune_take(t, 0)) >= 0)
+        {
+            sf_tune_one(t, idx);
+        }
+    while (t->finished < t->count)
+        {
+            pthread_cond_wait(&t->done, &t->lock);
+        }
+    t->fn = NULL;
+    pthread_mutex_unlock(&t->lock);
+}
+
+/**********************************************************************************************
+ * sf_tune_stats: --stats, the concurrency the tuner settled on, on stderr.
+ **********************************************************************************************/
+
+void sf_tune_stats(sf_tune_t *t)
+{
+    if (t == NULL || t->ops == 0)
+        {
+            return;
+        }
+    fprintf(stderr, "tune   %-8s %s %d in flight (%d..%d, cap %d, %" PRIu64 " up, %" PRIu64 " down),"
+            " %" PRIu64 " ops, %.3f ms average\n", t->name, t->fixed ? "fixed at" : "settled on", t->limit,
+            t->lowest, t->highest, t->cap, t->increases, t->decreases, t->ops, t->nanos / 1e6 / t->ops);
+}
+
+void sf_tune_destroy(sf_tune_t *t)
+{
+    int idx;
+    if (t == NULL)
+        {
+            return;
+        }
+    pthread_mutex_lock(&t->lock);
+    t->stop = 1;
+    pthread_cond_broadcast(&t->slot);
+    pthread_mutex_unlock(&t->lock);
+    for (idx = 0; idx < t->nthreads; idx++)
+        {
+            pthread_join(t->threads[idx], NULL);
+        }
+    pthread_cond_destroy(&t->slot);
+    pthread_cond_destroy(&t->done);
+    pthread_mutex_destroy(&t->lock);
+    free(t->threads);
+    free(t);
+}
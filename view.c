@@ -10,19 +10,29 @@
  ** Create an issue at the project for consideration to merge the pull request.
  */
 
+/* qsort_r */
+#define _GNU_SOURCE
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include "models.h"
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "summarizefiles.h"
 
 /**
  * view orientated code for the project. Display the results to the user.
  */
 
-void sf_sortentries(sumfiles_t *self, sumentry_t *results, size_t result_size);
-int sf_compare_size_desc(const void *a, const void *b);
-int sf_compare_group(const void *a, const void *b);
-int sf_compare_lines_desc(const void *a, const void *b);
+// what an entry needs next to its label: "|: 999.999 MB in 999999 files"
+#define SF_VIEW_COUNTS 30
+
+int sf_compare_size_desc(const void *a, const void *b, void *groups);
+int sf_compare_group(const void *a, const void *b, void *groups);
+int sf_compare_lines_desc(const void *a, const void *b, void *groups);
+int sf_compare_dupes_desc(const void *a, const void *b, void *groups);
 
 char *show_size(char *strbuf, size_t bytes)
 {
@@ -35,50 +45,135 @@ char *show_size(char *strbuf, size_t bytes)
     else if (bytes >= 1024.0)
         sprintf(strbuf, " %9.3f KB", bytes / 1024.0);
     else
-        sprintf(strbuf, " %9.0f B  ", bytes);
+        sprintf(strbuf, " %9.0f B  ", (double)bytes);
 
     return strbuf;
 }
 
-char *se_show(sumfiles_t *self, sumentry_t *entry, char *sbufentry)
+/**********************************************************************************************
+ * sf_sparkline: Draw a log2 size histogram as SF_SPARK_CELLS characters, each covering four
+ *   buckets (a factor of 16 in size) starting at 1 byte, the last cell holding everything from
+ *   64 GB up. Heights are relative to the fullest cell of the same histogram.
+ **********************************************************************************************/
+
+#define SF_SPARK_CELLS 10
+
+static char *sf_sparkline(const uint64_t *hist, char *spark)
+{
+    static const char levels[] = " .:-=+*#";
+    uint64_t cells[SF_SPARK_CELLS] = { 0 };
+    uint64_t most = 0;
+    int bucket, cell;
+
+    for (bucket = 0; bucket < SF_HIST_BUCKETS; bucket++)
+        {
+            cell = bucket / 4 < SF_SPARK_CELLS ? bucket / 4 : SF_SPARK_CELLS - 1;
+            cells[cell] += hist[bucket];
+        }
+    for (cell = 0; cell < SF_SPARK_CELLS; cell++)
+        {
+            most = cells[cell] > most ? cells[cell] : most;
+        }
+    for (cell = 0; cell < SF_SPARK_CELLS; cell++)
+        {
+            // any file at all gets at least the lowest mark
+            int level = cells[cell] == 0 ? 0 : 1 + (int)((cells[cell] * (sizeof(levels) - 3)) / most);
+            spark[cell] = levels[level];
+        }
+    spark[SF_SPARK_CELLS] = 0;
+    return spark;
+}
+
+char *se_show(sumfiles_t *self, sf_groups_t *groups, uint32_t id, char *sbufentry, size_t size)
 {
     char sbufbytes[256];
     memset(sbufbytes, 0, sizeof(sbufbytes));
     char group[self->colsize];
-    strcpy(group, entry->group);
-    group[10]=0;
+    snprintf(group, sizeof(group), "%.10s", groups->key[id]);
 
 
-    char *dval=group;
-    if ((self->popts == SF_TIME)!=0)
+    const char *dval=group;
+    if ((self->popts & SF_TIME)!=0)
+        {
+            dval=groups->label[id];
+        }
+    if ((self->popts & SF_OWNER)!=0)
+        {
+            // the names are looked up now, the scan only knows the ids
+            char owner[256];
+            snprintf(group, sizeof(group), "%.22s", sf_owner_label(self, groups->key[id], owner, sizeof(owner)));
+        }
+    if ((self->popts & SF_MIME)!=0)
         {
-            dval=entry->label;
+            char type[256];
+            char label[64];
+            const char *charset;
+            sf_mime_split(groups->key[id], type, sizeof(type), &charset);
+            snprintf(label, sizeof(label), "%.30s %.10s", type, charset);
+            // leave the rest of the column to the counts
+            int room = SF_VIEW_COUNTS;
+            room += (self->popts & SF_HIST) != 0 && self->probes == 0 ? SF_SPARK_CELLS + 1 : 0;
+            room += (self->popts & SF_DUPES) != 0 && self->probes == 0 ? 16 : 0;
+            room += self->probes > 0 ? 9 : 0;
+            int width = self->colsize - room > 10 ? self->colsize - room : 10;
+            snprintf(group, sizeof(group), "%.*s", width, label);
         }
 
-    if ((self->popts == SF_LINES)!=0)
+    if ((self->popts & SF_LINES)!=0)
         {
-            sprintf(sbufbytes, "%d lines", entry->line_count);
+            sprintf(sbufbytes, "%" PRIu64 " lines", groups->lines[id]);
         }
     else
         {
-            show_size(sbufbytes, entry->total_bytes);
+            show_size(sbufbytes, groups->bytes[id]);
+        }
+    if ((self->popts & SF_HIST) != 0 && self->probes == 0 && groups->hist != NULL)
+        {
+            char spark[SF_SPARK_CELLS + 1];
+            strcat(sbufbytes, " ");
+            strcat(sbufbytes, sf_sparkline(&groups->hist[id * SF_HIST_BUCKETS], spark));
+        }
+    if (self->probes > 0)
+        {
+            char sbufci[16];
+            if (isfinite(self->ci[id]) && self->ci[id] < 10)
+                {
+                    sprintf(sbufci, "+-%.0f%%", self->ci[id] * 100);
+                }
+            else
+                {
+                    strcpy(sbufci, "+-?");
+                }
+            snprintf(sbufentry, size, "|%10s: ~%10s %6s in ~%" PRIu64 " files", dval, sbufbytes, sbufci, groups->files[id]);
+        }
+    else
+        {
+            snprintf(sbufentry, size, "|%10s: %10s in %" PRIu64 " files", dval, sbufbytes, groups->files[id]);
+        }
+    if ((self->popts & SF_DUPES) != 0 && self->probes == 0 && groups->dupbytes != NULL)
+        {
+            char sbufdupes[32];
+            size_t used = strlen(sbufentry);
+            snprintf(sbufentry + used, size - used, ",%s dup", show_size(sbufdupes, groups->dupbytes[id]));
+        }
+    if ((size_t)self->colsize < size)
+        {
+            sbufentry[self->colsize]=0;
         }
-    sprintf(sbufentry, "|%10s: %10s in %d files", dval, sbufbytes, entry->file_count);
-    sbufentry[self->colsize]=0;
 
     return sbufentry;
 }
 
-void sf_renderline(sumfiles_t *self, sumentry_t *results, size_t result_size, int row)
+void sf_renderline(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size, int row)
 {
-    char sbufentry[self->console_cols + 1];
+    char sbufentry[(self->console_cols > self->colsize ? self->console_cols : self->colsize) + 1];
     char outbuf[self->console_cols+2];
     char colbuf[self->colsize+1];
     char *outbufp = outbuf;
 
     //printf("Before outbuf zero out rsize=%d.\n", result_size);
     memset(outbuf, ' ', sizeof(outbuf));
-    outbuf[sizeof(outbuf)]=0;
+    outbuf[sizeof(outbuf)-1]=0;
     //printf("After outbuf zero out. row=%d\n", row);
 
     // identify the entries that should appear in the rendered display
@@ -93,9 +188,15 @@ void sf_renderline(sumfiles_t *self, sumentry_t *results, size_t result_size, in
     while (idx<result_size)
         {
             //printf("idx=%d, col=%d ncols=%d res_size=%d\n",idx, colidx, self->entries_per_line, result_size);
-            sprintf(colbuf, "%-*s", self->colsize, se_show(self, &results[idx], sbufentry) );
-            colbuf[self->colsize]=0;
-            memcpy(outbufp+(colidx*self->colsize), colbuf, strlen(colbuf));
+            snprintf(colbuf, sizeof(colbuf), "%-*s", self->colsize, se_show(self, groups, order[idx], sbufentry, sizeof(sbufentry)) );
+            // the last column is cut at the edge of the console
+            size_t at = colidx*self->colsize;
+            size_t len = strlen(colbuf);
+            if (at + len > sizeof(outbuf) - 1)
+                {
+                    len = at < sizeof(outbuf) - 1 ? sizeof(outbuf) - 1 - at : 0;
+                }
+            memcpy(outbufp+at, colbuf, len);
             if (drows<1)
                 {
                     break;
@@ -134,28 +235,44 @@ char *formatmtime(time_t fmtime, char *sbuf, int bufsize)
     return sbuf;
 }
 
-void sf_showresults(sumfiles_t *self, sumentry_t *results, size_t result_size)
+/* The comparators see only group ids and get the table to look them up in, scans on other
+ * threads sort at the same time */
+static void sf_sortresults(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size)
 {
-    char sbufentry[1024];
-
-    self->entries_per_line = self->console_cols / self->colsize;
-    self->dentries = (self->entries_per_line) * (self->console_rows - 2);
-
+    if (result_size == 0)
+        {
+            // an empty tree, order is not even allocated
+            return;
+        }
     if ((self->popts & SF_TIME)!=0)
         {
-            qsort( results, result_size, sizeof(sumentry_t), sf_compare_group );
+            qsort_r( order, result_size, sizeof(uint32_t), sf_compare_group, groups );
         }
     else
         {
-            if ((self->popts & SF_LINES)!=0)
+            if ((self->popts & SF_DUPES)!=0 && groups->dupbytes != NULL)
                 {
-                    qsort( results, result_size, sizeof(sumentry_t), sf_compare_lines_desc );
+                    qsort_r( order, result_size, sizeof(uint32_t), sf_compare_dupes_desc, groups );
+                }
+            else if ((self->popts & SF_LINES)!=0)
+                {
+                    qsort_r( order, result_size, sizeof(uint32_t), sf_compare_lines_desc, groups );
                 }
             else
                 {
-                    qsort( results, result_size, sizeof(sumentry_t), sf_compare_size_desc );
+                    qsort_r( order, result_size, sizeof(uint32_t), sf_compare_size_desc, groups );
                 }
         }
+}
+
+void sf_showresults(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size)
+{
+    char sbufentry[1024];
+
+    self->entries_per_line = self->console_cols / self->colsize;
+    self->dentries = (self->entries_per_line) * (self->console_rows - 2);
+
+    sf_sortresults(self, groups, order, result_size);
 
     /*
     int idx = 0;
@@ -167,7 +284,7 @@ void sf_showresults(sumfiles_t *self, sumentry_t *results, size_t result_size)
 
     if ( (self->popts & SF_DEBUG)  )
         {
-            printf("res_size=%d\n", result_size);
+            printf("res_size=%zu\n", result_size);
             printf("view_entries=%d\n", self->dentries);
 
             printf("Buckle up, it's go time!\n");
@@ -187,9 +304,13 @@ void sf_showresults(sumfiles_t *self, sumentry_t *results, size_t result_size)
             formatmtime(self->min_mod_time, mindatebuf, 64);
             formatmtime(self->max_mod_time, maxdatebuf, 64);
 
-            if (self->console_cols>82)
+            if (self->probes > 0)
+                {
+                    printf("%s %s  estimated from %" PRIu64 " samples, scan in progress\n\n", sbufentry, self->rootpathdisp, self->probes);
+                }
+            else if (self->console_cols>82)
                 {
-                    printf("%s %s  min mdate: %s   max mdate: %s exceptions: %d\n\n", sbufentry, self->rootpathdisp, mindatebuf, maxdatebuf, self->exceptions);
+                    printf("%s %s  min mdate: %s   max mdate: %s exceptions: %" PRIu64 "\n\n", sbufentry, self->rootpathdisp, mindatebuf, maxdatebuf, self->exceptions);
                 }
             else
                 {
@@ -200,38 +321,342 @@ void sf_showresults(sumfiles_t *self, sumentry_t *results, size_t result_size)
     int ridx;
     for (ridx=0; ridx<self->console_rows-3; ridx++)
         {
-            sf_renderline(self, results, result_size, ridx);
+            sf_renderline(self, groups, order, result_size, ridx);
+        }
+}
+
+/**********************************************************************************************
+ * sf_showstats: --stats, how fast the content of --lines files was read, per compression
+ *   format, how many files --dupes had to read, the concurrency of the stats and reads (see
+ *   tune.c), and how fast a --replay went. Goes to stderr, so it can be combined with --json.
+ **********************************************************************************************/
+
+void sf_showstats(sumfiles_t *self)
+{
+    char readbuf[32], decodedbuf[32];
+    int codec;
+
+    int header = 0;
+    for (codec = 0; codec < SF_CODECS; codec++)
+        {
+            struct sf_codecstats *stats = &self->codecstats[codec];
+            if (stats->files == 0)
+                {
+                    continue;
+                }
+            if (!header++)
+                {
+                    fprintf(stderr, "%-6s %10s %13s %13s %10s\n", "codec", "files", "read", "decoded", "MB/s");
+                }
+            double secs = stats->nanos / 1e9;
+            fprintf(stderr, "%-6s %10" PRIu64 " %13s %13s %10.1f\n", sf_codec_names[codec], stats->files,
+                    show_size(readbuf, stats->inbytes), show_size(decodedbuf, stats->outbytes),
+                    secs > 0 ? stats->outbytes / secs / 1048576.0 : 0.0);
+        }
+    if (self->mime_detected + self->mime_cached > 0)
+        {
+            fprintf(stderr, "magic  %10" PRIu64 " files detected, %" PRIu64 " verdicts cached\n",
+                    self->mime_detected, self->mime_cached);
+        }
+    sf_dupes_stats(self->dupes);
+    sf_tune_stats(self->stattune);
+    sf_pool_stats(self->pool);
+    if (self->replayed > 0)
+        {
+            double secs = self->replay_nanos / 1e9;
+            fprintf(stderr, "replay %10" PRIu64 " files in %.3f s, %.0f files/s\n", self->replayed, secs,
+                    secs > 0 ? self->replayed / secs : 0.0);
+        }
+}
+
+static int sf_compare_top_desc(const void *a, const void *b)
+{
+    int64_t v1 = ((const struct sf_topfile *)a)->value;
+    int64_t v2 = ((const struct sf_topfile *)b)->value;
+    return (v2 > v1) - (v2 < v1);
+}
+
+/* Copy one top list of a group out of its heap, largest value first */
+static uint32_t sf_toplist(sf_groups_t *groups, uint32_t id, int list, struct sf_topfile *sorted)
+{
+    uint32_t used = groups->ntop[id * SF_TOP_LISTS + list];
+    memcpy(sorted, &groups->top[(id * SF_TOP_LISTS + list) * groups->topn], used * sizeof(struct sf_topfile));
+    qsort(sorted, used, sizeof(struct sf_topfile), sf_compare_top_desc);
+    return used;
+}
+
+/**********************************************************************************************
+ * sf_showtop: --top, below the final screen list the largest and the newest files of the
+ *   groups on it, in the order they are shown. With --watch files deleted since they were
+ *   counted are left out.
+ **********************************************************************************************/
+
+void sf_showtop(sumfiles_t *self)
+{
+    sf_groups_t *groups = self->shown;
+    char sbuf[64];
+    size_t idx;
+
+    if (groups == NULL || groups->topn == 0)
+        {
+            return;
+        }
+    struct sf_topfile sorted[groups->topn];
+    size_t count = self->nshown < (size_t)self->dentries ? self->nshown : (size_t)self->dentries;
+    for (idx = 0; idx < count; idx++)
+        {
+            uint32_t id = self->order[idx];
+            uint32_t used, entry;
+            int list;
+            char owner[256];
+            const char *title = (self->popts & SF_TIME) ? groups->label[id] : groups->key[id];
+            if ((self->popts & SF_OWNER))
+                {
+                    title = sf_owner_label(self, groups->key[id], owner, sizeof(owner));
+                }
+
+            printf("\n%s %s in %" PRIu64 " files\n", title, show_size(sbuf, groups->bytes[id]), groups->files[id]);
+            for (list = 0; list < SF_TOP_LISTS; list++)
+                {
+                    used = sf_toplist(groups, id, list, sorted);
+                    for (entry = 0; entry < used; entry++)
+                        {
+                            struct stat info;
+                            if (self->watch != NULL && lstat(sorted[entry].path, &info) != 0)
+                                {
+                                    continue;
+                                }
+                            if (list == SF_TOP_LARGEST)
+                                {
+                                    printf("  largest %s  %s\n", show_size(sbuf, sorted[entry].value), sorted[entry].path);
+                                }
+                            else
+                                {
+                                    char datebuf[64];
+                                    struct tm mtime;
+                                    time_t when = sorted[entry].value;
+                                    localtime_r(&when, &mtime);
+                                    strftime(datebuf, sizeof(datebuf), SF_DATETIMEFMT, &mtime);
+                                    printf("  newest  %13s  %s\n", datebuf, sorted[entry].path);
+                                }
+                        }
+                }
         }
 }
 
-int sf_compare_size_desc(const void *a, const void *b)
+static void sf_jsonstring(FILE *out, const char *str)
 {
-    const sumentry_t *e1 = (const sumentry_t *)a;
-    const sumentry_t *e2 = (const sumentry_t *)b;
-    //printf("compare: %s.%d == %s.%d\n", e1->group, e1->total_bytes, e2->group, e2->total_bytes );
-    return e2->total_bytes - e1->total_bytes;
+    putc('"', out);
+    for (; *str; str++)
+        {
+            unsigned char ch = *str;
+            if (ch == '"' || ch == '\\')
+                {
+                    fprintf(out, "\\%c", ch);
+                }
+            else if (ch < 0x20)
+                {
+                    fprintf(out, "\\u%04x", ch);
+                }
+            else
+                {
+                    putc(ch, out);
+                }
+        }
+    putc('"', out);
 }
 
-int sf_compare_lines_desc(const void *a, const void *b)
+/**********************************************************************************************
+ * sf_showjson: --json, write the groups to stdout as one JSON document instead of drawing the
+ *   screen. Every group is listed, in the same order as the screen. With --hist each group
+ *   carries "size_hist", the file count per log2 size bucket keyed by the bucket's smallest
+ *   size in bytes, empty buckets left out. With --cube the groups are the cells, each given
+ *   by its "ext" and "time" instead of a "key". With --by-owner the owner is given as "uid",
+ *   "gid", "user" and "group" next to the "key", with "ext" for --by-owner=ext. With --top,
+ *   "largest" and "newest" list the group's top files. With --dupes, "dupbytes" and "dupfiles"
+ *   give the bytes and the number of files that are copies of another file.
+ **********************************************************************************************/
+
+void sf_showjson(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size)
 {
-    const sumentry_t *e1 = (const sumentry_t *)a;
-    const sumentry_t *e2 = (const sumentry_t *)b;
-    return e2->line_count - e1->line_count;
+    size_t idx;
+
+    sf_sortresults(self, groups, order, result_size);
+
+    printf("{\n  \"root\": ");
+    sf_jsonstring(stdout, self->rootpath);
+    printf(",\n  \"min_mtime\": %ld,\n  \"max_mtime\": %ld,\n  \"exceptions\": %" PRIu64 ",\n  \"groups\": [",
+           (long)self->min_mod_time, (long)self->max_mod_time, self->exceptions);
+    for (idx = 0; idx < result_size; idx++)
+        {
+            uint32_t id = order[idx];
+            printf("%s\n    {", idx ? "," : "");
+            if ((self->popts & SF_CUBE) != 0)
+                {
+                    // a cell of the cube, give both coordinates
+                    const char *timekey;
+                    size_t extlen = sf_cube_split(groups->key[id], &timekey);
+                    char ext[extlen + 1];
+                    memcpy(ext, groups->key[id], extlen);
+                    ext[extlen] = 0;
+                    printf("\"ext\": ");
+                    sf_jsonstring(stdout, ext);
+                    printf(", \"time\": ");
+                    sf_jsonstring(stdout, timekey);
+                }
+            else
+                {
+                    printf("\"key\": ");
+                    sf_jsonstring(stdout, groups->key[id]);
+                }
+            uint32_t uid, gid;
+            const char *ext;
+            if ((self->popts & SF_OWNER) != 0 && sf_owner_split(groups->key[id], &uid, &gid, &ext) == 0)
+                {
+                    const char *user, *group;
+                    sf_owner_names(self, groups->key[id], &user, &group, &ext);
+                    printf(", \"uid\": %u, \"gid\": %u, \"user\": ", uid, gid);
+                    sf_jsonstring(stdout, user);
+                    printf(", \"group\": ");
+                    sf_jsonstring(stdout, group);
+                    if ((self->popts & SF_OWNEREXT) != 0)
+                        {
+                            printf(", \"ext\": ");
+                            sf_jsonstring(stdout, ext);
+                        }
+                }
+            if ((self->popts & SF_MIME) != 0)
+                {
+                    char type[256];
+                    const char *charset;
+                    printf(", \"type\": ");
+                    sf_jsonstring(stdout, sf_mime_split(groups->key[id], type, sizeof(type), &charset));
+                    printf(", \"charset\": ");
+                    sf_jsonstring(stdout, charset);
+                }
+            if (groups->label[id][0])
+                {
+                    printf(", \"label\": ");
+                    sf_jsonstring(stdout, groups->label[id]);
+                }
+            printf(", \"bytes\": %" PRIu64 ", \"files\": %" PRIu64, groups->bytes[id], groups->files[id]);
+            if ((self->popts & SF_LINES) != 0)
+                {
+                    printf(", \"lines\": %" PRIu64, groups->lines[id]);
+                }
+            printf(", \"min_mtime\": %ld, \"max_mtime\": %ld",
+                   (long)groups->min_mtime[id], (long)groups->max_mtime[id]);
+            if (groups->dupbytes != NULL)
+                {
+                    printf(", \"dupbytes\": %" PRIu64 ", \"dupfiles\": %" PRIu64, groups->dupbytes[id], groups->dupfiles[id]);
+                }
+            if (groups->hist != NULL)
+                {
+                    const uint64_t *hist = &groups->hist[id * SF_HIST_BUCKETS];
+                    const char *sep = "";
+                    int bucket;
+                    printf(", \"size_hist\": {");
+                    for (bucket = 0; bucket < SF_HIST_BUCKETS; bucket++)
+                        {
+                            if (hist[bucket] != 0)
+                                {
+                                    printf("%s\"%" PRIu64 "\": %" PRIu64, sep,
+                                           bucket ? (uint64_t)1 << bucket : 0, hist[bucket]);
+                                    sep = ", ";
+                                }
+                        }
+                    printf("}");
+                }
+            if (groups->topn > 0)
+                {
+                    struct sf_topfile sorted[groups->topn];
+                    int list;
+                    for (list = 0; list < SF_TOP_LISTS; list++)
+                        {
+                            uint32_t used = sf_toplist(groups, id, list, sorted), entry;
+                            printf(list == SF_TOP_LARGEST ? ", \"largest\": [" : ", \"newest\": [");
+                            for (entry = 0; entry < used; entry++)
+                                {
+                                    printf("%s{\"path\": ", entry ? ", " : "");
+                                    sf_jsonstring(stdout, sorted[entry].path);
+                                    printf(list == SF_TOP_LARGEST ? ", \"bytes\": %" PRId64 "}" : ", \"mtime\": %" PRId64 "}",
+                                           sorted[entry].value);
+                                }
+                            printf("]");
+                        }
+                }
+            printf("}");
+        }
+    printf("\n  ]\n}\n");
 }
 
-int sf_compare_group(const void *a, const void *b)
+/**********************************************************************************************
+ * sf_showcallback: Hand the groups to a library caller instead of drawing them, in view order.
+ *   The array is reused from one call to the next.
+ **********************************************************************************************/
+
+void sf_showcallback(sumfiles_t *self, sf_groups_t *groups, uint32_t *order, size_t result_size,
+                     sf_groups_cb callback)
 {
-    const sumentry_t *e1 = (const sumentry_t *)a;
-    const sumentry_t *e2 = (const sumentry_t *)b;
+    size_t idx;
 
-    return strcmp( e2->group, e1->group);
+    sf_sortresults(self, groups, order, result_size);
+    if (self->results_size < result_size)
+        {
+            struct sf_group *results = realloc(self->results, result_size * sizeof(struct sf_group));
+            if (results == NULL)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    return;
+                }
+            self->results = results;
+            self->results_size = result_size;
+        }
+    for (idx = 0; idx < result_size; idx++)
+        {
+            uint32_t id = order[idx];
+            struct sf_group *result = &self->results[idx];
+            result->key = groups->key[id];
+            result->label = groups->label[id];
+            result->bytes = groups->bytes[id];
+            result->files = groups->files[id];
+            result->lines = groups->lines[id];
+            result->min_mtime = groups->min_mtime[id];
+            result->max_mtime = groups->max_mtime[id];
+            result->dupbytes = groups->dupbytes != NULL ? groups->dupbytes[id] : 0;
+            result->dupfiles = groups->dupfiles != NULL ? groups->dupfiles[id] : 0;
+        }
+    callback(self->config.cbdata, self->results, result_size);
 }
 
-/*
-void sf_sortentries(sumfiles_t *self, sumentry_t *results, size_t result_size)
+int sf_compare_size_desc(const void *a, const void *b, void *groups)
 {
-  qsort( results, result_size, sizeof(sumentry_t), sf_compare_size_desc );
+    uint64_t v1 = ((const sf_groups_t *)groups)->bytes[*(const uint32_t *)a];
+    uint64_t v2 = ((const sf_groups_t *)groups)->bytes[*(const uint32_t *)b];
+    return (v2 > v1) - (v2 < v1);
+}
 
-  return 0;
-  }*/
+int sf_compare_lines_desc(const void *a, const void *b, void *groups)
+{
+    uint64_t v1 = ((const sf_groups_t *)groups)->lines[*(const uint32_t *)a];
+    uint64_t v2 = ((const sf_groups_t *)groups)->lines[*(const uint32_t *)b];
+    return (v2 > v1) - (v2 < v1);
+}
 
+/* --dupes: the most bytes to reclaim first, by size while the scan is still running */
+int sf_compare_dupes_desc(const void *a, const void *b, void *groups)
+{
+    uint64_t v1 = ((const sf_groups_t *)groups)->dupbytes[*(const uint32_t *)a];
+    uint64_t v2 = ((const sf_groups_t *)groups)->dupbytes[*(const uint32_t *)b];
+    if (v1 == v2)
+        {
+            return sf_compare_size_desc(a, b, groups);
+        }
+    return (v2 > v1) - (v2 < v1);
+}
+
+int sf_compare_group(const void *a, const void *b, void *groups)
+{
+    const char **key = ((const sf_groups_t *)groups)->key;
+    return strcmp( key[*(const uint32_t *)b], key[*(const uint32_t *)a]);
+}
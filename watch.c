@@ -0,0 +1,1013 @@
+/*
+ ** Copyright (c) 2024 Bluestone Consulting Group, LLC
+ ** Copyright (c) 2024 Rob Seward <rseward@bluestone-consulting.com>
+ **
+ ** This program is free software; please use, redistribute and modify it under the terms of
+ ** the BSD license. (Chosen to be compatible with the libcfu library).
+ **
+ ** If you modify it for a specific purpose please consider making a pull request here:
+ **
+ ** Create an issue at the project for consideration to merge the pull request.
+ */
+
+/* open_by_handle_at, struct file_handle */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fts.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include "summarizefiles.h"
+
+/**
+ * --watch: after the initial scan keep the group totals current from filesystem events.
+ * Every file counted during the scan is remembered by path (hash, directory id and name)
+ * together with what it contributed to its group. A change is applied by subtracting the old contribution and
+ * adding the new one, so only the files that changed are ever looked at again. Writes to a
+ * file kept open (a log) and changes of its mtime arrive as MODIFY and ATTRIB events; those
+ * are collected and applied once per SF_WATCH_DEBOUNCE ms, every file at most once.
+ *
+ * fanotify with directory file handles (FAN_REPORT_DFID_NAME) covers a whole filesystem
+ * with one mark, but needs CAP_SYS_ADMIN and a filesystem that can encode file handles.
+ * Otherwise every directory gets an inotify watch as the scan walks past it, and so do the
+ * directories of a later root on a filesystem fanotify can not mark.
+ */
+
+#define SF_WATCH_INITIAL 4096
+#define SF_WATCH_FREE    0
+#define SF_WATCH_DELETED 1
+
+#define SF_WATCH_DEBOUNCE 1000
+
+// the mtime bounds a file held when it was taken out, see sf_watch_bounds
+#define SF_WATCH_MIN 1
+#define SF_WATCH_MAX 2
+
+#define SF_WATCH_INOTIFY_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY \
+                               | IN_ATTRIB | IN_DONT_FOLLOW)
+#define SF_WATCH_FANOTIFY_MASK (FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO \
+                                | FAN_MODIFY | FAN_ATTRIB | FAN_ONDIR)
+
+struct sf_watchfile
+{
+    uint64_t hash;           // path hash, SF_WATCH_FREE or SF_WATCH_DELETED for empty slots
+    uint32_t dir;            // id of the parent directory
+    const char *name;        // in the arena, kept by a deleted slot for the path to come back
+    int changed;             // waiting among watch->changed
+    int bound;               // SF_WATCH_MIN and SF_WATCH_MAX, until the path is tracked again
+    uint64_t bytes;
+    uint64_t lines;
+    time_t mtime;
+    const char *key;         // borrowed from the group table that counted the file
+    const char *label;
+};
+
+struct sf_watch
+{
+    pthread_mutex_t lock;
+    sf_arena_t arena;        // directory and root paths
+
+    struct sf_watchfile *files;
+    size_t capacity;
+    size_t used;             // live and deleted slots
+
+    const char **dirs;       // directory id -> path
+    size_t ndirs;
+    size_t dirsize;
+    uint32_t *dirslots;      // open addressing on the path hash, directory id + 1
+    size_t dircapacity;
+    uint32_t lastdir;        // consecutive files nearly always share a parent
+
+    uint32_t *wddirs;        // inotify watch descriptor -> directory id + 1
+    size_t wdsize;
+
+    const char *roots[64];
+    int rootfds[64];
+    int rootino[64];         // the root is watched with inotify, fanotify could not mark it
+    int nroots;
+
+    int fanfd;
+    int inofd;
+    int warned;
+    volatile sig_atomic_t stop; // set by sf_watch_interrupt
+
+    char **changed;          // paths with MODIFY or ATTRIB events not applied yet
+    size_t nchanged;
+    size_t changedsize;
+    struct timespec since;   // the first of those events
+
+    size_t stale;            // files taken out that held a bound of their group or the root
+};
+
+static uint64_t sf_watch_hash(const char *str, size_t len)
+{
+    uint64_t hash = 14695981039346656037UL;
+    size_t idx;
+    for (idx = 0; idx < len; idx++)
+        {
+            hash ^= (unsigned char)str[idx];
+            hash *= 1099511628211UL;
+        }
+    // keep clear of the two markers used for empty slots
+    return hash < 2 ? hash + 2 : hash;
+}
+
+sf_watch_t *sf_watch_new(void)
+{
+    sf_watch_t *watch = calloc(1, sizeof(sf_watch_t)); // freed by sf_watch_destroy
+    if (watch == NULL)
+        {
+            return NULL;
+        }
+    watch->files = calloc(SF_WATCH_INITIAL, sizeof(struct sf_watchfile));
+    watch->dirslots = calloc(SF_WATCH_INITIAL, sizeof(uint32_t));
+    if (watch->files == NULL || watch->dirslots == NULL)
+        {
+            free(watch->files);
+            free(watch->dirslots);
+            free(watch);
+            return NULL;
+        }
+    watch->capacity = SF_WATCH_INITIAL;
+    watch->dircapacity = SF_WATCH_INITIAL;
+    watch->lastdir = UINT32_MAX;
+    watch->inofd = -1;
+    pthread_mutex_init(&watch->lock, NULL);
+
+#ifdef FAN_REPORT_DFID_NAME
+    watch->fanfd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY);
+#else
+    watch->fanfd = -1;
+#endif
+    if (watch->fanfd < 0)
+        {
+            watch->inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (watch->inofd < 0)
+                {
+                    perror("inotify_init1");
+                    sf_watch_destroy(watch);
+                    return NULL;
+                }
+        }
+    return watch;
+}
+
+/**********************************************************************************************
+ * sf_watch_addroot: Register a tree before it is scanned, so nothing that changes during the
+ *   scan is lost. Falls back to inotify if the filesystem can not be marked with fanotify.
+ **********************************************************************************************/
+
+int sf_watch_addroot(sf_watch_t *watch, const char *rootpath)
+{
+    if (watch->nroots == sizeof(watch->roots) / sizeof(watch->roots[0]))
+        {
+            fprintf(stderr, "--watch supports at most %d directories\n", watch->nroots);
+            return -1;
+        }
+
+    char real[PATH_MAX];
+    if (realpath(rootpath, real) == NULL)
+        {
+            perror(rootpath);
+            return -1;
+        }
+    watch->roots[watch->nroots] = sf_arena_strdup(&watch->arena, real);
+    watch->rootfds[watch->nroots] = open(real, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    watch->nroots++;
+
+    if (watch->fanfd >= 0
+            && fanotify_mark(watch->fanfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, SF_WATCH_FANOTIFY_MASK,
+                             AT_FDCWD, real) != 0)
+        {
+            if (watch->nroots > 1)
+                {
+                    // earlier trees rely on the filesystem mark, watch this one with inotify
+                    if (watch->inofd < 0)
+                        {
+                            watch->inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                            if (watch->inofd < 0)
+                                {
+                                    perror("inotify_init1");
+                                    watch->nroots--;
+                                    if (watch->rootfds[watch->nroots] >= 0)
+                                        {
+                                            close(watch->rootfds[watch->nroots]);
+                                        }
+                                    return -1;
+                                }
+                        }
+                    watch->rootino[watch->nroots - 1] = 1;
+                    return 0;
+                }
+            close(watch->fanfd);
+            watch->fanfd = -1;
+            watch->inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (watch->inofd < 0)
+                {
+                    perror("inotify_init1");
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+static int sf_watch_growdirs(sf_watch_t *watch)
+{
+    size_t capacity = watch->dircapacity * 2;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL)
+        {
+            return -1;
+        }
+    uint32_t id;
+    for (id = 0; id < watch->ndirs; id++)
+        {
+            size_t idx = sf_watch_hash(watch->dirs[id], strlen(watch->dirs[id])) & (capacity - 1);
+            while (slots[idx] != 0)
+                {
+                    idx = (idx + 1) & (capacity - 1);
+                }
+            slots[idx] = id + 1;
+        }
+    free(watch->dirslots);
+    watch->dirslots = slots;
+    watch->dircapacity = capacity;
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_watch_dirid: Intern the directory path[0..len) and return its id, UINT32_MAX on failure.
+ **********************************************************************************************/
+
+static uint32_t sf_watch_dirid(sf_watch_t *watch, const char *path, size_t len)
+{
+    if (watch->lastdir != UINT32_MAX)
+        {
+            const char *last = watch->dirs[watch->lastdir];
+            if (strncmp(last, path, len) == 0 && last[len] == 0)
+                {
+                    return watch->lastdir;
+                }
+        }
+
+    size_t idx = sf_watch_hash(path, len) & (watch->dircapacity - 1);
+    uint32_t slot;
+    while ((slot = watch->dirslots[idx]) != 0)
+        {
+            const char *dir = watch->dirs[slot - 1];
+            if (strncmp(dir, path, len) == 0 && dir[len] == 0)
+                {
+                    watch->lastdir = slot - 1;
+                    return slot - 1;
+                }
+            idx = (idx + 1) & (watch->dircapacity - 1);
+        }
+
+    if (watch->ndirs == watch->dirsize)
+        {
+            size_t size = watch->dirsize ? watch->dirsize * 2 : 1024;
+            const char **dirs = realloc(watch->dirs, size * sizeof(char *));
+            if (dirs == NULL)
+                {
+                    return UINT32_MAX;
+                }
+            watch->dirs = dirs;
+            watch->dirsize = size;
+        }
+    if ((watch->ndirs + 1) * 10 > watch->dircapacity * 7)
+        {
+            if (sf_watch_growdirs(watch) != 0)
+                {
+                    return UINT32_MAX;
+                }
+            idx = sf_watch_hash(path, len) & (watch->dircapacity - 1);
+            while (watch->dirslots[idx] != 0)
+                {
+                    idx = (idx + 1) & (watch->dircapacity - 1);
+                }
+        }
+
+    char *copy = sf_arena_alloc(&watch->arena, len + 1);
+    if (copy == NULL)
+        {
+            return UINT32_MAX;
+        }
+    memcpy(copy, path, len);
+    copy[len] = 0;
+
+    uint32_t id = watch->ndirs++;
+    watch->dirs[id] = copy;
+    watch->dirslots[idx] = id + 1;
+    watch->lastdir = id;
+    return id;
+}
+
+/* Whether path is under one of the roots, with inotify set one of those watched with inotify */
+static int sf_watch_inroots(sf_watch_t *watch, const char *path, int inotify)
+{
+    int idx;
+    for (idx = 0; idx < watch->nroots; idx++)
+        {
+            size_t len = strlen(watch->roots[idx]);
+            if ((!inotify || watch->rootino[idx])
+                    && strncmp(path, watch->roots[idx], len) == 0 && (path[len] == '/' || path[len] == 0 || len == 1))
+                {
+                    return 1;
+                }
+        }
+    return 0;
+}
+
+/**********************************************************************************************
+ * sf_watch_adddir: Called for every directory the scan enters. With inotify this is where the
+ *   directory gets its watch.
+ **********************************************************************************************/
+
+void sf_watch_adddir(sf_watch_t *watch, const char *dirpath)
+{
+    size_t len = strlen(dirpath);
+    while (len > 1 && dirpath[len - 1] == '/')
+        {
+            len--;
+        }
+
+    pthread_mutex_lock(&watch->lock);
+    uint32_t id = sf_watch_dirid(watch, dirpath, len);
+    if (id != UINT32_MAX && watch->inofd >= 0
+            && (watch->fanfd < 0 || sf_watch_inroots(watch, watch->dirs[id], 1)))
+        {
+            const char *path = watch->dirs[id];
+            int wd = inotify_add_watch(watch->inofd, path, SF_WATCH_INOTIFY_MASK | IN_ONLYDIR);
+            if (wd < 0)
+                {
+                    if (errno == ENOSPC && !watch->warned)
+                        {
+                            fprintf(stderr, "inotify watch limit reached, raise fs.inotify.max_user_watches\n");
+                            watch->warned = 1;
+                        }
+                }
+            else
+                {
+                    if ((size_t)wd >= watch->wdsize)
+                        {
+                            size_t size = watch->wdsize ? watch->wdsize : 1024;
+                            while (size <= (size_t)wd)
+                                {
+                                    size *= 2;
+                                }
+                            uint32_t *wddirs = realloc(watch->wddirs, size * sizeof(uint32_t));
+                            if (wddirs != NULL)
+                                {
+                                    memset(wddirs + watch->wdsize, 0, (size - watch->wdsize) * sizeof(uint32_t));
+                                    watch->wddirs = wddirs;
+                                    watch->wdsize = size;
+                                }
+                        }
+                    if ((size_t)wd < watch->wdsize)
+                        {
+                            watch->wddirs[wd] = id + 1;
+                        }
+                }
+        }
+    pthread_mutex_unlock(&watch->lock);
+}
+
+static int sf_watch_growfiles(sf_watch_t *watch)
+{
+    size_t live = 0, idx;
+    for (idx = 0; idx < watch->capacity; idx++)
+        {
+            live += watch->files[idx].hash > SF_WATCH_DELETED;
+        }
+
+    // only grow when the table is really full, otherwise just sweep out the deleted slots
+    size_t capacity = watch->capacity;
+    if (live * 2 > capacity)
+        {
+            capacity *= 2;
+        }
+    struct sf_watchfile *files = calloc(capacity, sizeof(struct sf_watchfile));
+    if (files == NULL)
+        {
+            return -1;
+        }
+    for (idx = 0; idx < watch->capacity; idx++)
+        {
+            struct sf_watchfile *file = &watch->files[idx];
+            if (file->hash > SF_WATCH_DELETED)
+                {
+                    size_t to = file->hash & (capacity - 1);
+                    while (files[to].hash != SF_WATCH_FREE)
+                        {
+                            to = (to + 1) & (capacity - 1);
+                        }
+                    files[to] = *file;
+                }
+        }
+    free(watch->files);
+    watch->files = files;
+    watch->capacity = capacity;
+    watch->used = live;
+    return 0;
+}
+
+/* Whether the slot holds path, two paths may share a hash */
+static int sf_watch_is(sf_watch_t *watch, const struct sf_watchfile *file, const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t dirlen = slash == NULL ? 0 : (size_t)(slash - path);
+    const char *dir = watch->dirs[file->dir];
+
+    if (strcmp(file->name, slash != NULL ? slash + 1 : path) != 0)
+        {
+            return 0;
+        }
+    return dirlen ? strncmp(dir, path, dirlen) == 0 && dir[dirlen] == 0 : strcmp(dir, "/") == 0;
+}
+
+/* The slot of path; with deleted set also the deleted slot it had, to take it over again */
+static struct sf_watchfile *sf_watch_find(sf_watch_t *watch, uint64_t hash, const char *path, int deleted)
+{
+    size_t idx = hash & (watch->capacity - 1);
+    while (watch->files[idx].hash != SF_WATCH_FREE)
+        {
+            struct sf_watchfile *file = &watch->files[idx];
+            if ((file->hash == hash || (deleted && file->hash == SF_WATCH_DELETED))
+                    && sf_watch_is(watch, file, path))
+                {
+                    return file;
+                }
+            idx = (idx + 1) & (watch->capacity - 1);
+        }
+    return NULL;
+}
+
+/**********************************************************************************************
+ * sf_watch_track: Remember what fullpath contributed to its group. key and label must be the
+ *   copies owned by a group table, they are used later to take the contribution back out.
+ **********************************************************************************************/
+
+void sf_watch_track(sf_watch_t *watch, const char *fullpath, const char *key, const char *label,
+                    const sf_filerec_t *rec)
+{
+    const char *slash = strrchr(fullpath, '/');
+    size_t dirlen = slash == NULL ? 0 : (size_t)(slash - fullpath);
+    uint64_t hash = sf_watch_hash(fullpath, strlen(fullpath));
+
+    pthread_mutex_lock(&watch->lock);
+    // a changed file is forgotten and tracked again right away, it finds its deleted slot
+    struct sf_watchfile *file = sf_watch_find(watch, hash, fullpath, 1);
+    if (file == NULL)
+        {
+            uint32_t dir = sf_watch_dirid(watch, dirlen ? fullpath : "/", dirlen ? dirlen : 1);
+            const char *name = sf_arena_strdup(&watch->arena, slash != NULL ? slash + 1 : fullpath);
+            if (dir == UINT32_MAX || name == NULL
+                    || ((watch->used + 1) * 10 > watch->capacity * 7 && sf_watch_growfiles(watch) != 0))
+                {
+                    pthread_mutex_unlock(&watch->lock);
+                    return;
+                }
+            size_t idx = hash & (watch->capacity - 1);
+            while (watch->files[idx].hash > SF_WATCH_DELETED)
+                {
+                    idx = (idx + 1) & (watch->capacity - 1);
+                }
+            file = &watch->files[idx];
+            if (file->hash == SF_WATCH_FREE)
+                {
+                    watch->used++;
+                }
+            file->dir = dir;
+            file->name = name;
+            file->bound = 0;
+        }
+    if (file->bound == SF_WATCH_MAX && rec->mtime >= file->mtime && strcmp(file->key, key) == 0)
+        {
+            // a write to the newest file of a group, it is still the newest
+            watch->stale--;
+        }
+    file->hash = hash;
+    file->changed = 0;
+    file->bound = 0;
+    file->bytes = rec->bytes;
+    file->lines = rec->lines;
+    file->mtime = rec->mtime;
+    file->key = key;
+    file->label = label;
+    pthread_mutex_unlock(&watch->lock);
+}
+
+/* Take a file's contribution back out of its group, the caller holds the watch lock */
+static void sf_watch_subtract(sumfiles_t *self, struct sf_watchfile *file)
+{
+    sf_groups_t *groups = sf_localgroups(self);
+    if (groups != NULL)
+        {
+            pthread_mutex_lock(&groups->lock);
+            int32_t id = sf_groups_intern(groups, file->key, file->label, 1);
+            if (id >= 0)
+                {
+                    // the counters are unsigned, the negative deltas wrap and cancel out when the
+                    //   thread tables are merged
+                    sf_groups_add(groups, id, -file->bytes, -1, -file->lines, LONG_MAX, 0);
+                    if (groups->hist != NULL)
+                        {
+                            groups->hist[id * SF_HIST_BUCKETS + SF_HIST_BUCKET(file->bytes)]--;
+                        }
+                }
+            pthread_mutex_unlock(&groups->lock);
+        }
+
+    // the mtimes cannot be taken back out, a file that held the oldest or newest mtime of its
+    //   group or of the whole tree has the bounds recomputed by sf_watch_bounds. The snapshot is
+    //   the one of the last refresh, a group it does not have yet is taken to be held
+    int32_t shown = sf_groups_find(&self->snapshot, file->key);
+    if (shown < 0 || file->mtime <= self->snapshot.min_mtime[shown] || file->mtime <= self->min_mod_time)
+        {
+            file->bound |= SF_WATCH_MIN;
+        }
+    if (shown < 0 || file->mtime >= self->snapshot.max_mtime[shown] || file->mtime >= self->max_mod_time)
+        {
+            file->bound |= SF_WATCH_MAX;
+        }
+    if (file->bound != 0)
+        {
+            self->watch->stale++;
+        }
+    file->hash = SF_WATCH_DELETED;
+}
+
+/**********************************************************************************************
+ * sf_watch_bounds: A file that held the oldest or newest mtime of its group went away or was
+ *   changed. Set the mtime bounds of every group and of the tree to those of the files still
+ *   there: every thread table is cleared of them and the bounds go into the local table, the
+ *   merge takes the oldest and newest over the tables. This walks the whole file table, but
+ *   only after such a batch of events.
+ **********************************************************************************************/
+
+static void sf_watch_bounds(sumfiles_t *self)
+{
+    sf_watch_t *watch = self->watch;
+    sf_groups_t *local = sf_localgroups(self);
+    sf_groups_t *groups;
+    time_t min_mtime = INT_MAX, max_mtime = 0;
+    uint32_t id;
+    size_t idx;
+
+    if (watch->stale == 0 || local == NULL)
+        {
+            return;
+        }
+    pthread_mutex_lock(&watch->lock);
+    pthread_mutex_lock(&self->lock);
+    for (groups = self->groups; groups != NULL; groups = groups->chain)
+        {
+            pthread_mutex_lock(&groups->lock);
+            for (id = 0; id < groups->count; id++)
+                {
+                    groups->min_mtime[id] = LONG_MAX;
+                    groups->max_mtime[id] = 0;
+                }
+            pthread_mutex_unlock(&groups->lock);
+        }
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_mutex_lock(&local->lock);
+    for (idx = 0; idx < watch->capacity; idx++)
+        {
+            struct sf_watchfile *file = &watch->files[idx];
+            if (file->hash <= SF_WATCH_DELETED)
+                {
+                    continue;
+                }
+            int32_t group = sf_groups_intern(local, file->key, file->label, 1);
+            if (group >= 0)
+                {
+                    sf_groups_add(local, group, 0, 0, 0, file->mtime, file->mtime);
+                }
+            if (file->mtime < min_mtime)
+                {
+                    min_mtime = file->mtime;
+                }
+            if (file->mtime > max_mtime)
+                {
+                    max_mtime = file->mtime;
+                }
+        }
+    pthread_mutex_unlock(&local->lock);
+
+    self->min_mod_time = min_mtime;
+    self->max_mod_time = max_mtime;
+    watch->stale = 0;
+    pthread_mutex_unlock(&watch->lock);
+}
+
+static void sf_watch_forget(sumfiles_t *self, const char *path)
+{
+    sf_watch_t *watch = self->watch;
+    pthread_mutex_lock(&watch->lock);
+    struct sf_watchfile *file = sf_watch_find(watch, sf_watch_hash(path, strlen(path)), path, 0);
+    if (file != NULL)
+        {
+            sf_watch_subtract(self, file);
+        }
+    pthread_mutex_unlock(&watch->lock);
+}
+
+/**********************************************************************************************
+ * sf_watch_forgetdir: A directory was moved out of the tree, drop every file below it. This
+ *   walks the whole table, but only happens on a rename of a directory.
+ **********************************************************************************************/
+
+static void sf_watch_forgetdir(sumfiles_t *self, const char *path)
+{
+    sf_watch_t *watch = self->watch;
+    size_t len = strlen(path);
+
+    pthread_mutex_lock(&watch->lock);
+    char *below = calloc(watch->ndirs ? watch->ndirs : 1, 1);
+    if (below == NULL)
+        {
+            pthread_mutex_unlock(&watch->lock);
+            return;
+        }
+    uint32_t id;
+    for (id = 0; id < watch->ndirs; id++)
+        {
+            const char *dir = watch->dirs[id];
+            below[id] = strncmp(dir, path, len) == 0 && (dir[len] == 0 || dir[len] == '/');
+        }
+
+    size_t idx;
+    for (idx = 0; idx < watch->capacity; idx++)
+        {
+            struct sf_watchfile *file = &watch->files[idx];
+            if (file->hash > SF_WATCH_DELETED && below[file->dir])
+                {
+                    sf_watch_subtract(self, file);
+                }
+        }
+    free(below);
+    pthread_mutex_unlock(&watch->lock);
+}
+
+/* A directory appeared: watch it and count what is already in it */
+static void sf_watch_walk(sumfiles_t *self, const char *path)
+{
+    char *ftsargv[2] = { (char *)path, NULL };
+    FTS *fts = fts_open(ftsargv, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    FTSENT *ent;
+
+    if (fts == NULL)
+        {
+            return;
+        }
+    while ((ent = fts_read(fts)) != NULL)
+        {
+            if (ent->fts_info == FTS_D)
+                {
+                    sf_watch_adddir(self->watch, ent->fts_path);
+                }
+            else if (ent->fts_info == FTS_F)
+                {
+                    sf_watch_forget(self, ent->fts_path);
+                    sf_addentry(self, ent->fts_path, ent->fts_name, ent->fts_statp);
+                }
+        }
+    fts_close(fts);
+}
+
+/**********************************************************************************************
+ * sf_watch_event: Apply one event. The old contribution of the path is always taken out
+ *   before the current state is added back, so repeated events for a path are harmless.
+ **********************************************************************************************/
+
+static void sf_watch_event(sumfiles_t *self, const char *path, int isdir, int movedfrom, int gone)
+{
+    if (isdir)
+        {
+            if (movedfrom)
+                {
+                    sf_watch_forgetdir(self, path);
+                }
+            else if (!gone)
+                {
+                    sf_watch_walk(self, path);
+                }
+            return;
+        }
+
+    sf_watch_forget(self, path);
+    if (gone)
+        {
+            return;
+        }
+
+    struct stat info;
+    if (lstat(path, &info) == 0)
+        {
+            const char *base = strrchr(path, '/');
+            sf_addentry(self, path, base ? base + 1 : path, &info);
+        }
+}
+
+/* A file was written to or had its attributes changed, apply it with the next batch */
+static void sf_watch_changed(sumfiles_t *self, const char *path)
+{
+    sf_watch_t *watch = self->watch;
+
+    pthread_mutex_lock(&watch->lock);
+    struct sf_watchfile *file = sf_watch_find(watch, sf_watch_hash(path, strlen(path)), path, 0);
+    int queued = file != NULL && file->changed;
+    if (file != NULL)
+        {
+            file->changed = 1;
+        }
+    pthread_mutex_unlock(&watch->lock);
+    if (queued || (watch->nchanged > 0 && strcmp(watch->changed[watch->nchanged - 1], path) == 0))
+        {
+            // untracked files are only kept from repeating back to back
+            return;
+        }
+
+    if (watch->nchanged == watch->changedsize)
+        {
+            size_t size = watch->changedsize ? watch->changedsize * 2 : 64;
+            char **changed = realloc(watch->changed, size * sizeof(char *));
+            if (changed == NULL)
+                {
+                    __sync_fetch_and_add(&self->exceptions, 1);
+                    return;
+                }
+            watch->changed = changed;
+            watch->changedsize = size;
+        }
+    watch->changed[watch->nchanged] = strdup(path); // freed by sf_watch_flush
+    if (watch->changed[watch->nchanged] == NULL)
+        {
+            __sync_fetch_and_add(&self->exceptions, 1);
+            return;
+        }
+    if (watch->nchanged++ == 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &watch->since);
+        }
+}
+
+/* Apply the changed files once the batch is SF_WATCH_DEBOUNCE ms old, or now with force */
+static void sf_watch_flush(sumfiles_t *self, int force)
+{
+    sf_watch_t *watch = self->watch;
+    struct timespec now;
+    size_t idx;
+
+    if (watch->nchanged == 0)
+        {
+            return;
+        }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!force && (now.tv_sec - watch->since.tv_sec) * 1000 + (now.tv_nsec - watch->since.tv_nsec) / 1000000
+            < SF_WATCH_DEBOUNCE)
+        {
+            return;
+        }
+    for (idx = 0; idx < watch->nchanged; idx++)
+        {
+            sf_watch_event(self, watch->changed[idx], 0, 0, 0);
+            free(watch->changed[idx]);
+        }
+    watch->nchanged = 0;
+}
+
+static void sf_watch_readinotify(sumfiles_t *self)
+{
+    sf_watch_t *watch = self->watch;
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(watch->inofd, buf, sizeof(buf))) > 0)
+        {
+            char *ptr = buf;
+            while (ptr < buf + len)
+                {
+                    struct inotify_event *ev = (struct inotify_event *)ptr;
+                    ptr += sizeof(struct inotify_event) + ev->len;
+
+                    if (ev->mask & IN_Q_OVERFLOW)
+                        {
+                            // events were dropped, the totals may drift until the next full scan
+                            __sync_fetch_and_add(&self->exceptions, 1);
+                            continue;
+                        }
+                    if (ev->len == 0 || ev->wd < 0 || (size_t)ev->wd >= watch->wdsize || watch->wddirs[ev->wd] == 0)
+                        {
+                            continue;
+                        }
+
+                    char path[PATH_MAX];
+                    pthread_mutex_lock(&watch->lock);
+                    int plen = snprintf(path, sizeof(path), "%s/%s", watch->dirs[watch->wddirs[ev->wd] - 1],
+                                        ev->name);
+                    pthread_mutex_unlock(&watch->lock);
+                    if (plen < 0 || (size_t)plen >= sizeof(path))
+                        {
+                            // too long to be opened, the scan could not have counted it either
+                            __sync_fetch_and_add(&self->exceptions, 1);
+                            continue;
+                        }
+
+                    if ((ev->mask & (IN_MODIFY | IN_ATTRIB)))
+                        {
+                            // a directory's own attributes change nothing that is counted
+                            if ((ev->mask & IN_ISDIR) == 0)
+                                {
+                                    sf_watch_changed(self, path);
+                                }
+                            continue;
+                        }
+                    sf_watch_event(self, path, (ev->mask & IN_ISDIR) != 0, (ev->mask & IN_MOVED_FROM) != 0,
+                                   (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0);
+                }
+        }
+}
+
+#ifdef FAN_REPORT_DFID_NAME
+static void sf_watch_readfanotify(sumfiles_t *self)
+{
+    sf_watch_t *watch = self->watch;
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t len;
+
+    while ((len = read(watch->fanfd, buf, sizeof(buf))) > 0)
+        {
+            struct fanotify_event_metadata *md = (struct fanotify_event_metadata *)buf;
+            for (; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len))
+                {
+                    if (md->mask & FAN_Q_OVERFLOW)
+                        {
+                            __sync_fetch_and_add(&self->exceptions, 1);
+                            continue;
+                        }
+
+                    struct fanotify_event_info_fid *fid = (struct fanotify_event_info_fid *)(md + 1);
+                    if ((char *)(fid + 1) > (char *)md + md->event_len
+                            || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+                        {
+                            continue;
+                        }
+                    struct file_handle *fh = (struct file_handle *)fid->handle;
+                    const char *name = (const char *)(fh->f_handle + fh->handle_bytes);
+
+                    // the handle names the parent directory, resolve it to a path
+                    int dirfd = -1, idx;
+                    for (idx = 0; idx < watch->nroots && dirfd < 0; idx++)
+                        {
+                            dirfd = open_by_handle_at(watch->rootfds[idx], fh, O_PATH | O_CLOEXEC);
+                        }
+                    if (dirfd < 0)
+                        {
+                            continue;
+                        }
+                    char proc[64], dirpath[PATH_MAX], path[PATH_MAX];
+                    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dirfd);
+                    ssize_t dlen = readlink(proc, dirpath, sizeof(dirpath) - 1);
+                    close(dirfd);
+                    if (dlen <= 0)
+                        {
+                            continue;
+                        }
+                    dirpath[dlen] = 0;
+                    int plen = snprintf(path, sizeof(path), "%s/%s", strcmp(dirpath, "/") ? dirpath : "", name);
+                    if (plen < 0 || (size_t)plen >= sizeof(path))
+                        {
+                            __sync_fetch_and_add(&self->exceptions, 1);
+                            continue;
+                        }
+
+                    if (strcmp(name, ".") == 0 || !sf_watch_inroots(watch, path, 0))
+                        {
+                            continue;
+                        }
+                    if ((md->mask & (FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)) == 0)
+                        {
+                            // only MODIFY or ATTRIB, events of one file may be merged with others
+                            if ((md->mask & FAN_ONDIR) == 0)
+                                {
+                                    sf_watch_changed(self, path);
+                                }
+                            continue;
+                        }
+                    sf_watch_event(self, path, (md->mask & FAN_ONDIR) != 0, (md->mask & FAN_MOVED_FROM) != 0,
+                                   (md->mask & (FAN_DELETE | FAN_MOVED_FROM)) != 0);
+                }
+        }
+}
+#endif
+
+/**********************************************************************************************
+ * sf_watch_interrupt: Have sf_watch_run return within its next poll, see sf_interrupt.
+ **********************************************************************************************/
+
+void sf_watch_interrupt(sf_watch_t *watch)
+{
+    if (watch != NULL)
+        {
+            watch->stop = 1;
+        }
+}
+
+/**********************************************************************************************
+ * sf_watch_run: Follow the events until interrupted, refreshing the view as for a scan.
+ **********************************************************************************************/
+
+int sf_watch_run(sumfiles_t *self)
+{
+    sf_watch_t *watch = self->watch;
+
+    // fanotify, and inotify for the roots it could not mark, or inotify alone
+    struct pollfd pfd[2];
+    pfd[0].fd = watch->fanfd;
+    pfd[1].fd = watch->inofd;
+    pfd[0].events = pfd[1].events = POLLIN;
+    pfd[0].revents = pfd[1].revents = 0;
+
+    if ((self->popts & SF_DEBUG))
+        {
+            fprintf(stderr, "watching %zu directories with %s\n", watch->ndirs, watch->fanfd < 0 ? "inotify" : watch->inofd < 0 ? "fanotify" : "fanotify and inotify");
+        }
+
+    while (!watch->stop)
+        {
+            int ret = poll(pfd, 2, 300);
+            if (ret < 0 && errno != EINTR)
+                {
+                    perror("poll");
+                    return -1;
+                }
+            if (ret > 0)
+                {
+#ifdef FAN_REPORT_DFID_NAME
+                    if ((pfd[0].revents & POLLIN))
+                        {
+                            sf_watch_readfanotify(self);
+                        }
+#endif
+                    if ((pfd[1].revents & POLLIN))
+                        {
+                            sf_watch_readinotify(self);
+                        }
+                }
+            sf_watch_flush(self, 0);
+            sf_watch_bounds(self);
+            sf_refreshview(self);
+        }
+    // the final view holds the last writes too
+    sf_watch_flush(self, 1);
+    sf_watch_bounds(self);
+    return 0;
+}
+
+void sf_watch_destroy(sf_watch_t *watch)
+{
+    int idx;
+    if (watch == NULL)
+        {
+            return;
+        }
+    for (idx = 0; idx < watch->nroots; idx++)
+        {
+            if (watch->rootfds[idx] >= 0)
+                {
+                    close(watch->rootfds[idx]);
+                }
+        }
+    if (watch->fanfd >= 0)
+        {
+            close(watch->fanfd);
+        }
+    if (watch->inofd >= 0)
+        {
+            close(watch->inofd);
+        }
+    while (watch->nchanged > 0)
+        {
+            free(watch->changed[--watch->nchanged]);
+        }
+    free(watch->changed);
+    free(watch->files);
+    free(watch->dirs);
+    free(watch->dirslots);
+    free(watch->wddirs);
+    sf_arena_free(&watch->arena);
+    pthread_mutex_destroy(&watch->lock);
+    free(watch);
+}